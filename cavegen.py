@@ -0,0 +1,121 @@
+"""
+Python bindings for the cave generator (libcavegen.so).
+
+Build the library with ``make lib``. The library keeps a byte-per-cell
+and a bit-packed mirror of the cave, rewritten in place (one pass over the
+cells) by every call that changes it. Grids are returned as NumPy arrays
+viewing those mirrors, so reading them copies nothing on the Python side;
+each view keeps its Cave alive and always shows the latest state. ctypes releases the GIL while the
+library runs, so generators living in different threads step concurrently.
+
+Example::
+
+    import cavegen
+    cave = cavegen.Cave(256, 256, 0.45, 4, 3, seed=7)
+    cave.step(5)
+    walls = cave.grid          # uint8 array (height, width), 1 - wall
+    print(cave.stats())
+"""
+
+import ctypes
+import os
+
+import numpy as np
+
+_LIB_PATH = os.environ.get(
+    "CAVEGEN_LIB", os.path.join(os.path.dirname(os.path.abspath(__file__)), "libcavegen.so"))
+_lib = ctypes.CDLL(_LIB_PATH)
+
+_handle = ctypes.c_void_p
+
+_lib.cave_create.restype = _handle
+_lib.cave_create.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_double, ctypes.c_int, ctypes.c_int]
+_lib.cave_destroy.argtypes = [_handle]
+_lib.cave_init.argtypes = [_handle, ctypes.c_uint]
+_lib.cave_step.argtypes = [_handle, ctypes.c_int]
+_lib.cave_set_rules.argtypes = [_handle, ctypes.c_double, ctypes.c_int, ctypes.c_int]
+_lib.cave_morphology.argtypes = [_handle, ctypes.c_int, ctypes.c_int, ctypes.c_int]
+for _name in ("cave_width", "cave_height", "cave_words_per_row", "cave_room_count"):
+    getattr(_lib, _name).restype = ctypes.c_int
+    getattr(_lib, _name).argtypes = [_handle]
+_lib.cave_seed.restype = ctypes.c_uint
+_lib.cave_seed.argtypes = [_handle]
+_lib.cave_generation.restype = ctypes.c_longlong
+_lib.cave_generation.argtypes = [_handle]
+_lib.cave_alive_count.restype = ctypes.c_longlong
+_lib.cave_alive_count.argtypes = [_handle]
+_lib.cave_memory_bytes.restype = ctypes.c_longlong
+_lib.cave_memory_bytes.argtypes = [_handle]
+_lib.cave_bytes.restype = ctypes.POINTER(ctypes.c_uint8)
+_lib.cave_bytes.argtypes = [_handle]
+_lib.cave_packed.restype = ctypes.POINTER(ctypes.c_uint64)
+_lib.cave_packed.argtypes = [_handle]
+
+# Values of MorphOp and StructuringElement in main.cpp
+ERODE, DILATE, OPEN, CLOSE = range(4)
+SQUARE, DISK = range(2)
+
+
+class Cave:
+    """Cellular automaton cave generator."""
+
+    def __init__(self, width, height, birth_chance=0.45, birth_limit=4, death_limit=3, seed=None):
+        self._handle = _lib.cave_create(width, height, birth_chance, birth_limit, death_limit)
+        if not self._handle:
+            raise ValueError("invalid cave size")
+        self.width = width
+        self.height = height
+        self._words = _lib.cave_words_per_row(self._handle)
+        if seed is not None:
+            self.init(seed)
+
+    def __del__(self):
+        if getattr(self, "_handle", None):
+            _lib.cave_destroy(self._handle)
+            self._handle = None
+
+    def init(self, seed):
+        """Draw new starting noise from a seed."""
+        _lib.cave_init(self._handle, seed)
+
+    def step(self, n=1):
+        """Run n iterations of the automaton."""
+        _lib.cave_step(self._handle, n)
+
+    def set_rules(self, birth_chance, birth_limit, death_limit):
+        """Change the rules; the birth chance applies from the next init()."""
+        _lib.cave_set_rules(self._handle, birth_chance, birth_limit, death_limit)
+
+    def morphology(self, op, shape=SQUARE, radius=1):
+        """Post-process walls with ERODE, DILATE, OPEN or CLOSE."""
+        _lib.cave_morphology(self._handle, op, shape, radius)
+
+    def _view(self, pointer, ctype, shape):
+        """Read-only array over a library buffer that keeps this Cave alive."""
+        buffer = (ctype * (shape[0] * shape[1])).from_address(ctypes.addressof(pointer.contents))
+        buffer._owner = self
+        view = np.ctypeslib.as_array(buffer).reshape(shape)
+        view.flags.writeable = False
+        return view
+
+    @property
+    def grid(self):
+        """Read-only uint8 view (height, width); 1 - wall, 0 - open."""
+        return self._view(_lib.cave_bytes(self._handle), ctypes.c_uint8, (self.height, self.width))
+
+    @property
+    def packed(self):
+        """Read-only uint64 view (height, words per row); bit x % 64 of word x // 64."""
+        return self._view(_lib.cave_packed(self._handle), ctypes.c_uint64, (self.height, self._words))
+
+    def stats(self):
+        """Generation, seed, wall count, open ratio, room count and bytes used."""
+        alive = _lib.cave_alive_count(self._handle)
+        return {
+            "generation": _lib.cave_generation(self._handle),
+            "seed": _lib.cave_seed(self._handle),
+            "alive": alive,
+            "open_ratio": 1.0 - alive / float(self.width * self.height),
+            "rooms": _lib.cave_room_count(self._handle),
+            "memory": _lib.cave_memory_bytes(self._handle),
+        }
@@ -4,138 +4,3754 @@
  * @details Implementation of cave generation algorithm for Lab 5
  */
 
+#ifndef CAVE_LIBRARY
 #include <SFML/Graphics.hpp>
+#endif
 #include <iostream>
 #include <vector>
 #include <random>
 #include <algorithm>
 #include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <sstream>
+#include <cstdio>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @struct CaveRect
+ * @brief Axis-aligned rectangle of cells (x, y is the top-left corner)
+ */
+
+struct CaveRect {
+    int x, y, w, h;
+};
+
+/**
+ * @brief Run a function over a range split into contiguous chunks on worker threads
+ * @param begin First index of the range
+ * @param end One past the last index of the range
+ * @param func Callable invoked as func(chunkBegin, chunkEnd)
+ * @param workers Number of threads (0 - use all hardware threads)
+ */
+
+template <typename Func>
+void parallelFor(int begin, int end, Func func, int workers = 0) {
+    if (workers <= 0) {
+        workers = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    if (workers > end - begin) workers = end - begin;
+    if (workers <= 1) {
+        if (begin < end) func(begin, end);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    int chunk = (end - begin + workers - 1) / workers;
+    for (int start = begin; start < end; start += chunk) {
+        int stop = std::min(start + chunk, end);
+        threads.push_back(std::thread(func, start, stop));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+/**
+ * @class PackedGrid
+ * @brief Row-major bit grid packed into 64-bit words
+ *
+ * Bit (x % 64) of word (x / 64) in row y holds cell (x, y). Bits past
+ * the width of a row are always kept zero so word-wise operations can
+ * ignore the tail.
+ */
+
+class PackedGrid {
+private:
+    int width, height;
+    int wordsPerRow;
+    std::vector<uint64_t> words;
+
+public:
+    PackedGrid() : width(0), height(0), wordsPerRow(0) {}
+
+    /**
+     * @brief Create a cleared grid
+     * @param w Width in cells
+     * @param h Height in cells
+     */
+
+    PackedGrid(int w, int h)
+    : width(w), height(h), wordsPerRow((w + 63) / 64),
+    words(static_cast<size_t>((w + 63) / 64) * h, 0) {}
+
+    /**
+     * @brief Pack the cells of a cave that have a given state
+     * @param cave Column-major cave grid as returned by CaveGenerator::getCave()
+     * @param value State to select (true - walls, false - open cells)
+     * @return Grid with bits set where cave[x][y] == value
+     */
+
+    static PackedGrid fromCave(const std::vector<std::vector<bool>>& cave, bool value) {
+        int w = static_cast<int>(cave.size());
+        int h = w > 0 ? static_cast<int>(cave[0].size()) : 0;
+        PackedGrid grid(w, h);
+        for (int x = 0; x < w; x++) {
+            const std::vector<bool>& column = cave[x];
+            uint64_t bit = uint64_t(1) << (x & 63);
+            uint64_t* word = grid.words.data() + (x >> 6);
+            for (int y = 0; y < h; y++, word += grid.wordsPerRow) {
+                if (column[y] == value) *word |= bit;
+            }
+        }
+        return grid;
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getWordsPerRow() const { return wordsPerRow; }
+    size_t getMemoryBytes() const { return words.capacity() * sizeof(uint64_t); }
+
+    uint64_t* row(int y) { return words.data() + static_cast<size_t>(y) * wordsPerRow; }
+    const uint64_t* row(int y) const { return words.data() + static_cast<size_t>(y) * wordsPerRow; }
+
+    bool get(int x, int y) const {
+        return (row(y)[x >> 6] >> (x & 63)) & 1;
+    }
+
+    void set(int x, int y, bool value) {
+        uint64_t bit = uint64_t(1) << (x & 63);
+        if (value) {
+            row(y)[x >> 6] |= bit;
+        } else {
+            row(y)[x >> 6] &= ~bit;
+        }
+    }
+
+    void clear() {
+        std::fill(words.begin(), words.end(), 0);
+    }
+
+    /**
+     * @brief Mask of valid bits in the last word of a row
+     */
+
+    uint64_t tailMask() const {
+        return (width & 63) ? (uint64_t(1) << (width & 63)) - 1 : ~uint64_t(0);
+    }
+
+    /**
+     * @brief Number of set cells
+     */
+
+    long long count() const {
+        long long total = 0;
+        for (uint64_t w : words) total += __builtin_popcountll(w);
+        return total;
+    }
+};
+
+/**
+ * @brief Shift a packed row towards lower x
+ * @param src Source row
+ * @param dst Destination row (may not alias src)
+ * @param words Words per row
+ * @param shift Number of cells to shift by
+ *
+ * Bit x of dst becomes bit (x + shift) of src; cells shifted in from
+ * past the end of the row are zero.
+ */
+
+inline void shiftRowDown(const uint64_t* src, uint64_t* dst, int words, int shift) {
+    int wordShift = shift >> 6;
+    int bitShift = shift & 63;
+    for (int i = 0; i < words; i++) {
+        int j = i + wordShift;
+        uint64_t lo = j < words ? src[j] : 0;
+        uint64_t hi = j + 1 < words ? src[j + 1] : 0;
+        dst[i] = bitShift ? (lo >> bitShift) | (hi << (64 - bitShift)) : lo;
+    }
+}
+
+/**
+ * @brief Shift a packed row towards higher x
+ * @param src Source row
+ * @param dst Destination row (may not alias src)
+ * @param words Words per row
+ * @param shift Number of cells to shift by
+ *
+ * Bit x of dst becomes bit (x - shift) of src. The caller masks the
+ * tail of the last word if it matters.
+ */
+
+inline void shiftRowUp(const uint64_t* src, uint64_t* dst, int words, int shift) {
+    int wordShift = shift >> 6;
+    int bitShift = shift & 63;
+    for (int i = words - 1; i >= 0; i--) {
+        int j = i - wordShift;
+        uint64_t hi = j >= 0 ? src[j] : 0;
+        uint64_t lo = j - 1 >= 0 ? src[j - 1] : 0;
+        dst[i] = bitShift ? (hi << bitShift) | (lo >> (64 - bitShift)) : hi;
+    }
+}
+
+/**
+ * @brief Shapes of structuring elements for morphology
+ */
+
+enum class StructuringElement {
+    Square,
+    Disk
+};
+
+/**
+ * @brief Morphological operations on set cells
+ */
+
+enum class MorphOp {
+    Erode,
+    Dilate,
+    Open,
+    Close
+};
+
+/**
+ * @brief Dilate a packed row horizontally
+ * @param src Source row
+ * @param dst Destination row: bit x is the OR of src bits x - radius .. x + radius
+ * @param scratch Scratch space of two rows
+ * @param words Words per row
+ * @param radius Half-width of the window
+ * @param tail Mask of valid bits in the last word
+ */
+
+inline void dilateRow(const uint64_t* src, uint64_t* dst, uint64_t* scratch, int words, int radius, uint64_t tail) {
+    // OR over x .. x + radius and over x - radius .. x, each by doubling the shift
+    std::copy(src, src + words, dst);
+    std::copy(src, src + words, scratch + words);
+    uint64_t* back = scratch + words;
+    int length = radius + 1;
+    int span = 1;
+    while (span < length) {
+        int shift = std::min(span, length - span);
+        shiftRowDown(dst, scratch, words, shift);
+        for (int i = 0; i < words; i++) dst[i] |= scratch[i];
+        shiftRowUp(back, scratch, words, shift);
+        for (int i = 0; i < words; i++) back[i] |= scratch[i];
+        span += shift;
+    }
+    for (int i = 0; i < words; i++) dst[i] |= back[i];
+    dst[words - 1] &= tail;
+}
+
+/**
+ * @brief Dilate set cells by a structuring element
+ * @param src Source grid
+ * @param shape Square or disk
+ * @param radius Radius of the element (0 - copy)
+ * @param workers Worker threads (0 - all hardware threads)
+ * @return Dilated grid; cells outside the grid count as unset
+ *
+ * The element is decomposed into horizontal runs: each distinct run
+ * half-width is applied to every row once, then rows are OR-ed
+ * vertically with the half-width that belongs to their offset.
+ */
+
+inline PackedGrid dilateGrid(const PackedGrid& src, StructuringElement shape, int radius, int workers = 0) {
+    int w = src.getWidth();
+    int h = src.getHeight();
+    int words = src.getWordsPerRow();
+    if (radius <= 0 || w <= 0 || h <= 0) return src;
+
+    std::vector<int> halfWidth(radius + 1);
+    for (int dy = 0; dy <= radius; dy++) {
+        halfWidth[dy] = shape == StructuringElement::Square
+            ? radius
+            : static_cast<int>(std::floor(std::sqrt(static_cast<double>(radius * radius - dy * dy)) + 1e-9));
+    }
+
+    std::vector<int> distinct(halfWidth.begin(), halfWidth.end());
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+    std::vector<PackedGrid> horizontal(distinct.size(), PackedGrid(w, h));
+    uint64_t tail = src.tailMask();
+    parallelFor(0, h, [&](int rowBegin, int rowEnd) {
+        std::vector<uint64_t> scratch(2 * words);
+        for (size_t k = 0; k < distinct.size(); k++) {
+            for (int y = rowBegin; y < rowEnd; y++) {
+                dilateRow(src.row(y), horizontal[k].row(y), scratch.data(), words, distinct[k], tail);
+            }
+        }
+    }, workers);
+
+    std::vector<int> layer(radius + 1);
+    for (int dy = 0; dy <= radius; dy++) {
+        layer[dy] = static_cast<int>(std::lower_bound(distinct.begin(), distinct.end(), halfWidth[dy]) - distinct.begin());
+    }
+
+    PackedGrid result(w, h);
+    parallelFor(0, h, [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; y++) {
+            uint64_t* out = result.row(y);
+            for (int dy = -radius; dy <= radius; dy++) {
+                int sy = y + dy;
+                if (sy < 0 || sy >= h) continue;
+                const uint64_t* in = horizontal[layer[std::abs(dy)]].row(sy);
+                for (int i = 0; i < words; i++) out[i] |= in[i];
+            }
+        }
+    }, workers);
+
+    return result;
+}
+
+/**
+ * @brief Invert every cell of a grid
+ */
+
+inline PackedGrid complementGrid(const PackedGrid& src) {
+    PackedGrid result(src.getWidth(), src.getHeight());
+    uint64_t tail = src.tailMask();
+    int words = src.getWordsPerRow();
+    for (int y = 0; y < src.getHeight(); y++) {
+        const uint64_t* in = src.row(y);
+        uint64_t* out = result.row(y);
+        for (int i = 0; i < words; i++) out[i] = ~in[i];
+        if (words > 0) out[words - 1] &= tail;
+    }
+    return result;
+}
+
+/**
+ * @brief Apply a morphological operation to set cells
+ * @param src Source grid
+ * @param op Erode, dilate, open (erode then dilate) or close (dilate then erode)
+ * @param shape Square or disk
+ * @param radius Radius of the element
+ * @param workers Worker threads (0 - all hardware threads)
+ * @return Result grid
+ *
+ * Erosion treats cells outside the grid as set, so walls along the
+ * border are not eaten away.
+ */
+
+inline PackedGrid morphologyGrid(const PackedGrid& src, MorphOp op, StructuringElement shape, int radius, int workers = 0) {
+    switch (op) {
+    case MorphOp::Dilate:
+        return dilateGrid(src, shape, radius, workers);
+    case MorphOp::Erode:
+        return complementGrid(dilateGrid(complementGrid(src), shape, radius, workers));
+    case MorphOp::Open:
+        return dilateGrid(morphologyGrid(src, MorphOp::Erode, shape, radius, workers), shape, radius, workers);
+    case MorphOp::Close:
+        return morphologyGrid(dilateGrid(src, shape, radius, workers), MorphOp::Erode, shape, radius, workers);
+    }
+    return src;
+}
+
+/**
+ * @struct SharedCaveHeader
+ * @brief Header of a shared-memory cave segment
+ *
+ * The packed grid (PackedGrid layout, 64-bit words, wordsPerRow words per
+ * row) follows the header at dataOffset. sequence is odd while the writer
+ * is updating the grid: a reader copies or uses the grid and accepts it
+ * only if sequence was even and unchanged before and after (seqlock).
+ */
+
+struct SharedCaveHeader {
+    uint32_t magic;                     ///< 'CAVE'
+    uint32_t version;
+    int32_t width, height;
+    int32_t wordsPerRow;
+    uint32_t dataOffset;                ///< Bytes from the start of the segment to the grid
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> generation;   ///< Iteration of the published grid
+};
+
+const uint32_t sharedCaveMagic = 0x45564143;  // "CAVE" in little endian
+const uint32_t sharedCaveVersion = 1;
+
+/**
+ * @brief Size of a shared-memory cave segment
+ * @param w Width of the cave
+ * @param h Height of the cave
+ * @return Header plus packed grid in bytes
+ */
+
+inline size_t sharedCaveSize(int w, int h) {
+    size_t offset = (sizeof(SharedCaveHeader) + 63) / 64 * 64;
+    return offset + static_cast<size_t>((w + 63) / 64) * h * sizeof(uint64_t);
+}
+
+/**
+ * @class SharedCavePublisher
+ * @brief Publishes a cave in a named POSIX shared-memory segment
+ *
+ * Other local processes map the segment read-only and use the grid in
+ * place. The segment is removed when the publisher is destroyed.
+ */
+
+class SharedCavePublisher {
+private:
+    std::string name;
+    void* memory;
+    size_t size;
+    SharedCaveHeader* header;
+    uint64_t* data;
+
+    SharedCavePublisher(const SharedCavePublisher&);
+    SharedCavePublisher& operator=(const SharedCavePublisher&);
+
+public:
+    SharedCavePublisher() : name(), memory(MAP_FAILED), size(0), header(nullptr), data(nullptr) {}
+
+    ~SharedCavePublisher() {
+        close();
+    }
+
+    /**
+     * @brief Create (or replace) the segment
+     * @param segmentName Name of the segment, e.g. "/cave"
+     * @param w Width of the cave
+     * @param h Height of the cave
+     * @return true on success
+     */
+
+    bool open(const std::string& segmentName, int w, int h) {
+        close();
+        int fd = shm_open(segmentName.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0) {
+            std::cerr << "shm_open failed for " << segmentName << std::endl;
+            return false;
+        }
+
+        size = sharedCaveSize(w, h);
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            std::cerr << "Cannot resize shared memory " << segmentName << std::endl;
+            ::close(fd);
+            shm_unlink(segmentName.c_str());
+            return false;
+        }
+
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Cannot map shared memory " << segmentName << std::endl;
+            shm_unlink(segmentName.c_str());
+            return false;
+        }
+
+        name = segmentName;
+        header = new (memory) SharedCaveHeader();
+        header->width = w;
+        header->height = h;
+        header->wordsPerRow = (w + 63) / 64;
+        header->dataOffset = static_cast<uint32_t>((sizeof(SharedCaveHeader) + 63) / 64 * 64);
+        header->sequence.store(0);
+        header->generation.store(0);
+        header->version = sharedCaveVersion;
+        data = reinterpret_cast<uint64_t*>(static_cast<char*>(memory) + header->dataOffset);
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = sharedCaveMagic;
+        return true;
+    }
+
+    /**
+     * @brief Unmap and remove the segment
+     */
+
+    void close() {
+        if (memory != MAP_FAILED) {
+            munmap(memory, size);
+            shm_unlink(name.c_str());
+        }
+        memory = MAP_FAILED;
+        header = nullptr;
+        data = nullptr;
+    }
+
+    size_t getSize() const { return size; }
+
+    bool isOpen() const { return header != nullptr; }
+
+    /**
+     * @brief Write a new generation into the segment
+     * @param cave Column-major cave grid as returned by CaveGenerator::getCave()
+     * @param generation Iteration number of the grid
+     */
+
+    void publish(const std::vector<std::vector<bool>>& cave, uint64_t generation) {
+        if (!header) return;
+        int w = header->width;
+        int h = header->height;
+        int words = header->wordsPerRow;
+
+        header->sequence.fetch_add(1, std::memory_order_acq_rel);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::fill(data, data + static_cast<size_t>(words) * h, 0);
+        for (int x = 0; x < w && x < static_cast<int>(cave.size()); x++) {
+            const std::vector<bool>& column = cave[x];
+            uint64_t bit = uint64_t(1) << (x & 63);
+            uint64_t* word = data + (x >> 6);
+            for (int y = 0; y < h; y++, word += words) {
+                if (column[y]) *word |= bit;
+            }
+        }
+        header->generation.store(generation, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_release);
+        header->sequence.fetch_add(1, std::memory_order_release);
+    }
+};
+
+/**
+ * @class SharedCaveReader
+ * @brief Read-only view of a cave published by SharedCavePublisher
+ */
+
+class SharedCaveReader {
+private:
+    std::string name;
+    void* memory;
+    size_t size;
+    const SharedCaveHeader* header;
+    const uint64_t* data;
+    int width, height;  // layout validated on attach; the header is not trusted afterwards
+
+    SharedCaveReader(const SharedCaveReader&);
+    SharedCaveReader& operator=(const SharedCaveReader&);
+
+public:
+    SharedCaveReader() : name(), memory(MAP_FAILED), size(0), header(nullptr), data(nullptr), width(0), height(0) {}
+
+    ~SharedCaveReader() {
+        detach();
+    }
+
+    /**
+     * @brief Map a segment created by another process
+     * @param segmentName Name of the segment, e.g. "/cave"
+     * @return true if the segment exists and holds a cave
+     */
+
+    bool attach(const std::string& segmentName) {
+        detach();
+        int fd = shm_open(segmentName.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            std::cerr << "No shared cave named " << segmentName << std::endl;
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SharedCaveHeader)) {
+            std::cerr << "Shared cave " << segmentName << " is not ready" << std::endl;
+            ::close(fd);
+            return false;
+        }
+
+        size = static_cast<size_t>(info.st_size);
+        memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (memory == MAP_FAILED) {
+            std::cerr << "Cannot map shared cave " << segmentName << std::endl;
+            return false;
+        }
+
+        header = static_cast<const SharedCaveHeader*>(memory);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        int w = header->width;
+        int h = header->height;
+        bool valid = header->magic == sharedCaveMagic && header->version == sharedCaveVersion &&
+                     w > 0 && h > 0 && w <= (1 << 24) && h <= (1 << 24) &&
+                     header->wordsPerRow == (w + 63) / 64 &&
+                     header->dataOffset == (sizeof(SharedCaveHeader) + 63) / 64 * 64 &&
+                     sharedCaveSize(w, h) <= size;
+        if (!valid) {
+            std::cerr << "Shared cave " << segmentName << " has an unknown layout" << std::endl;
+            detach();
+            return false;
+        }
+
+        name = segmentName;
+        width = w;
+        height = h;
+        data = reinterpret_cast<const uint64_t*>(static_cast<const char*>(memory) + header->dataOffset);
+        return true;
+    }
+
+    void detach() {
+        if (memory != MAP_FAILED) munmap(memory, size);
+        memory = MAP_FAILED;
+        header = nullptr;
+        data = nullptr;
+    }
+
+    bool isAttached() const { return header != nullptr; }
+    const std::string& getName() const { return name; }
+    int getWidth() const { return header ? width : 0; }
+    int getHeight() const { return header ? height : 0; }
+
+    /**
+     * @brief Generation currently published (may change at any time)
+     */
+
+    uint64_t getGeneration() const {
+        return header ? header->generation.load(std::memory_order_relaxed) : 0;
+    }
+
+    /**
+     * @brief Copy a consistent generation out of the segment
+     * @param out Grid to fill (resized to the cave size)
+     * @param generation Generation number of the copied grid
+     * @return false if the writer kept the grid busy for every attempt
+     */
+
+    bool read(PackedGrid& out, uint64_t& generation) const {
+        if (!header) return false;
+        if (out.getWidth() != width || out.getHeight() != height) {
+            out = PackedGrid(width, height);
+        }
+        size_t words = static_cast<size_t>(out.getWordsPerRow()) * height;
+
+        for (int attempt = 0; attempt < 100; attempt++) {
+            uint64_t before = header->sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::memcpy(out.row(0), data, words * sizeof(uint64_t));
+            generation = header->generation.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->sequence.load(std::memory_order_relaxed) == before) return true;
+        }
+        return false;
+    }
+};
+
+/**
+ * @brief Bytes held by a column-major bool grid
+ */
+
+inline size_t cellGridBytes(const std::vector<std::vector<bool>>& grid) {
+    size_t bytes = grid.capacity() * sizeof(std::vector<bool>);
+    for (const std::vector<bool>& column : grid) {
+        bytes += (column.capacity() + 63) / 64 * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+/**
+ * @struct MemoryFootprint
+ * @brief Bytes used by a CaveGenerator, see CaveGenerator::getMemoryFootprint()
+ */
+
+struct MemoryFootprint {
+    size_t grid;         ///< Current cave
+    size_t history;      ///< Starting noise kept for resetToInitial(), flip counters
+    size_t constraints;  ///< Pinned-cell masks, allocated on first use
+    size_t dirtyTiles;   ///< Dirty flags for the viewer
+    size_t scratch;      ///< Peak temporary memory of simulateStep()
+    size_t shared;       ///< Mapped shared-memory segment
+
+    size_t total() const { return grid + history + constraints + dirtyTiles + scratch + shared; }
+};
+
+/**
+ * @class FlipHeatmap
+ * @brief Counts how often each cell changed state over a run
+ *
+ * Counters are 4-bit and saturate at 15; sixteen of them share a 64-bit
+ * word, so the map takes half a byte per cell. update() XORs consecutive
+ * packed generations and adds the flips to sixteen counters at a time.
+ */
+
+class FlipHeatmap {
+private:
+    int width, height;
+    int wordsPerRow;
+    std::vector<uint64_t> counters;
+    PackedGrid previous;
+
+    /**
+     * @brief Move bit i of a 16-bit value to bit 4 * i
+     */
+
+    static uint64_t spreadToNibbles(uint64_t bits) {
+        bits = (bits | (bits << 24)) & 0x000000FF000000FFULL;
+        bits = (bits | (bits << 12)) & 0x000F000F000F000FULL;
+        bits = (bits | (bits << 6)) & 0x0303030303030303ULL;
+        bits = (bits | (bits << 3)) & 0x1111111111111111ULL;
+        return bits;
+    }
+
+public:
+    static const int maxCount = 15;
+
+    FlipHeatmap() : width(0), height(0), wordsPerRow(0) {}
+
+    /**
+     * @brief Start counting from a generation
+     * @param walls Alive cells of the first generation; counters are cleared
+     */
+
+    void reset(const PackedGrid& walls) {
+        width = walls.getWidth();
+        height = walls.getHeight();
+        wordsPerRow = walls.getWordsPerRow() * 4;
+        counters.assign(static_cast<size_t>(wordsPerRow) * height, 0);
+        previous = walls;
+    }
+
+    /**
+     * @brief Take a new baseline without counting the change
+     */
+
+    void rebase(const PackedGrid& walls) {
+        if (walls.getWidth() != width || walls.getHeight() != height) {
+            reset(walls);
+        } else {
+            previous = walls;
+        }
+    }
+
+    /**
+     * @brief Count the cells that differ from the previous generation
+     * @param walls Alive cells of the next generation
+     */
+
+    void update(const PackedGrid& walls) {
+        if (walls.getWidth() != width || walls.getHeight() != height) {
+            reset(walls);
+            return;
+        }
+        const uint64_t low = 0x1111111111111111ULL;
+        int packedWords = walls.getWordsPerRow();
+        for (int y = 0; y < height; y++) {
+            const uint64_t* now = walls.row(y);
+            const uint64_t* before = previous.row(y);
+            uint64_t* row = counters.data() + static_cast<size_t>(y) * wordsPerRow;
+            for (int i = 0; i < packedWords; i++) {
+                uint64_t flips = now[i] ^ before[i];
+                if (!flips) continue;
+                for (int part = 0; part < 4; part++, flips >>= 16) {
+                    uint64_t& word = row[i * 4 + part];
+                    uint64_t full = word & (word >> 1) & (word >> 2) & (word >> 3) & low;
+                    word += spreadToNibbles(flips & 0xFFFF) & ~full;
+                }
+            }
+        }
+        previous = walls;
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    /**
+     * @brief Flips of a cell, 0-15 (15 - at least 15)
+     */
+
+    int get(int x, int y) const {
+        uint64_t word = counters[static_cast<size_t>(y) * wordsPerRow + (x >> 4)];
+        return static_cast<int>((word >> ((x & 15) * 4)) & 15);
+    }
+
+    size_t getMemoryBytes() const {
+        return counters.capacity() * sizeof(uint64_t) + previous.getMemoryBytes();
+    }
+};
+
+const int FlipHeatmap::maxCount;
+
+/**
+ * @struct StepStats
+ * @brief What one CaveGenerator::simulateStep() call changed
+ */
+
+struct StepStats {
+    long long births;         ///< Open cells that became walls
+    long long deaths;         ///< Walls that became open
+    long long unchanged;      ///< Cells that kept their state
+    long long neighbors[9];   ///< Cells by number of wall neighbours
+
+    StepStats() : births(0), deaths(0), unchanged(0), neighbors() {}
+
+    void add(const StepStats& other) {
+        births += other.births;
+        deaths += other.deaths;
+        unchanged += other.unchanged;
+        for (int i = 0; i < 9; i++) neighbors[i] += other.neighbors[i];
+    }
+};
+
+/**
+ * @brief Ways of counting neighbours in CaveGenerator::simulateStep()
+ *
+ * Cells looks at the eight neighbours of every cell; Columns keeps a
+ * running sum of three-cell column slices and reads each cell three times.
+ */
+
+enum class StepKernel {
+    Cells,
+    Columns
+};
+
+/**
+ * @brief How CaveGenerator::simulateStep() runs, see autoTuneStep()
+ */
+
+struct StepConfig {
+    StepKernel kernel;
+    int workers;      ///< Threads per step, 1 - run on the calling thread
+    int bandColumns;  ///< Columns handed to a thread at a time, rounded to dirty tiles
+
+    StepConfig() : kernel(StepKernel::Cells), workers(1), bandColumns(32) {}
+};
 
 /**
  * @class CaveGenerator
  * @brief Cellular automata for cave generation
  *
- * Implements the cave generation algorithm using cellular automata rules.
- * Cells can be alive (true) or dead (false) based on neighbor counts.
+ * Implements the cave generation algorithm using cellular automata rules.
+ * Cells can be alive (true) or dead (false) based on neighbor counts.
+ */
+
+class CaveGenerator {
+private:
+    int width, height;
+    std::vector<std::vector<bool>> cave;
+    std::vector<std::vector<bool>> initialCave;
+    std::vector<std::vector<bool>> forceOpen;
+    std::vector<std::vector<bool>> forceWall;
+    double birthChance;
+    int birthLimit;
+    int deathLimit;
+    unsigned seed;
+    int tileSize;
+    int tilesX, tilesY;
+    std::vector<char> dirtyTiles;
+    long long generation;
+    bool keepHistory;
+    StepConfig stepConfig;
+    bool collectStats;
+    StepStats lastStats;
+    bool trackFlips;
+    FlipHeatmap flips;
+    std::shared_ptr<SharedCavePublisher> publisher;
+
+    void publish() {
+        if (publisher) publisher->publish(cave, static_cast<uint64_t>(generation));
+    }
+
+    void markDirty(int x, int y) {
+        dirtyTiles[(y / tileSize) * tilesX + x / tileSize] = 1;
+    }
+
+    void markAllDirty() {
+        std::fill(dirtyTiles.begin(), dirtyTiles.end(), 1);
+    }
+
+    void restartFlips() {
+        if (trackFlips) flips.reset(PackedGrid::fromCave(cave, true));
+    }
+
+    bool isPinned() const {
+        return !forceOpen.empty();
+    }
+
+    void allocateMasks() {
+        if (isPinned()) return;
+        forceOpen.assign(width, std::vector<bool>(height, false));
+        forceWall.assign(width, std::vector<bool>(height, false));
+    }
+
+    /**
+     * @brief Count alive neighbors around a cell
+     * @param x X coordinate of the cell
+     * @param y Y coordinate of the cell
+     * @return Number of alive neighbors (0-8)
+     */
+
+    int countAliveNeighbors(int x, int y) {
+        int count = 0;
+        for (int i = -1; i <= 1; i++) {
+            for (int j = -1; j <= 1; j++) {
+                if (i == 0 && j == 0) continue;
+
+                int neighborX = x + i;
+                int neighborY = y + j;
+
+                if (neighborX >= 0 && neighborX < width && neighborY >= 0 && neighborY < height) {
+                    if (cave[neighborX][neighborY]) {
+                        count++;
+                    }
+                }
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief Apply the rules to columns [first, last) of the cave
+     * @param first First column
+     * @param last One past the last column
+     * @param next Grid receiving the changed cells
+     * @param stats Counters to update, or nullptr
+     */
+
+    void stepColumns(int first, int last, std::vector<std::vector<bool>>& next, StepStats* stats) {
+        bool columns = stepConfig.kernel == StepKernel::Columns;
+        std::vector<unsigned char> sums(columns ? height + 2 : 0, 0);
+
+        for (int x = first; x < last; x++) {
+            const std::vector<bool>& column = cave[x];
+            const std::vector<bool>* wallColumn = isPinned() ? &forceWall[x] : nullptr;
+            const std::vector<bool>* openColumn = isPinned() ? &forceOpen[x] : nullptr;
+
+            if (columns) {
+                for (int y = 0; y < height; y++) {
+                    sums[y + 1] = static_cast<unsigned char>((x > 0 && cave[x - 1][y]) + column[y] +
+                                                             (x + 1 < width && cave[x + 1][y]));
+                }
+            }
+
+            for (int y = 0; y < height; y++) {
+                int aliveNeighbors = columns ? sums[y] + sums[y + 1] + sums[y + 2] - column[y]
+                                             : countAliveNeighbors(x, y);
+                bool alive = column[y];
+
+                if (alive) {
+                    if (aliveNeighbors < deathLimit) {
+                        alive = false;
+                    }
+                } else {
+                    if (aliveNeighbors > birthLimit) {
+                        alive = true;
+                    }
+                }
+
+                if (wallColumn) alive = (alive || (*wallColumn)[y]) && !(*openColumn)[y];
+                if (stats) {
+                    stats->neighbors[aliveNeighbors]++;
+                    if (alive == column[y]) {
+                        stats->unchanged++;
+                    } else if (alive) {
+                        stats->births++;
+                    } else {
+                        stats->deaths++;
+                    }
+                }
+                if (alive != column[y]) {
+                    next[x][y] = alive;
+                    markDirty(x, y);
+                }
+            }
+        }
+    }
+
+public:
+
+    /**
+     * @brief Constructor for CaveGenerator
+     * @param w Width of the cave
+     * @param h Height of the cave
+     * @param chance Birth chance probability (0.0-1.0)
+     * @param birth Birth limit for new cells
+     * @param death Death limit for existing cells
+     */
+
+    CaveGenerator(int w, int h, double chance, int birth, int death)
+    : width(w), height(h), birthChance(chance), birthLimit(birth), deathLimit(death), seed(0),
+    tileSize(32), tilesX((w + 31) / 32), tilesY((h + 31) / 32), generation(0), keepHistory(true),
+    collectStats(false), trackFlips(false) {
+        dirtyTiles.assign(static_cast<size_t>(tilesX) * tilesY, 1);
+        cave.resize(width, std::vector<bool>(height, false));
+        initializeCave();
+    }
+
+    /**
+     * @brief Initialize cave with random cells based on birth chance
+     *
+     * Uses a fresh random seed; see initializeCave(unsigned) to reproduce a cave.
+     */
+
+    void initializeCave() {
+        std::random_device rd;
+        initializeCave(rd());
+    }
+
+    /**
+     * @brief Initialize cave with random cells from a fixed seed
+     * @param newSeed Seed of the random generator
+     */
+
+    void initializeCave(unsigned newSeed) {
+        seed = newSeed;
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<> dis(0.0, 1.0);
+
+        for (int x = 0; x < width; x++) {
+            for (int y = 0; y < height; y++) {
+                bool alive = (dis(gen) < birthChance);
+                cave[x][y] = isPinned() ? (alive || forceWall[x][y]) && !forceOpen[x][y] : alive;
+            }
+        }
+        if (keepHistory) initialCave = cave;
+        generation = 0;
+        restartFlips();
+        markAllDirty();
+        publish();
+    }
+
+    /**
+     * @brief Go back to the cave produced by the last initializeCave() call
+     *
+     * Lets the caller re-run the steps with different limits from the same
+     * starting noise without drawing it again. Without a kept copy (see
+     * setKeepHistory()) the noise is drawn again from the seed, with the
+     * cells pinned now.
+     */
+
+    void resetToInitial() {
+        if (initialCave.empty()) {
+            initializeCave(seed);
+            return;
+        }
+        cave = initialCave;
+        generation = 0;
+        restartFlips();
+        markAllDirty();
+        publish();
+    }
+
+    /**
+     * @brief Perform one iteration of cellular automata
+     *
+     * Applies the rules:
+     * - Alive cells die if neighbors < deathLimit
+     * - Dead cells become alive if neighbors > birthLimit
+     *
+     * Fixed cells are applied in the same pass: "force wall" cells are
+     * OR-ed in and "force open" cells are masked out of the result.
+     * Kernel and threads come from setStepConfig(). With setStepStats()
+     * enabled the same pass counts births, deaths and neighbour totals.
+     */
+
+    void simulateStep() {
+        std::vector<std::vector<bool>> newCave = cave;
+
+        // Bands cover whole dirty tiles, so threads never mark the same tile
+        int band = std::max(tileSize, stepConfig.bandColumns / tileSize * tileSize);
+        int bands = (width + band - 1) / band;
+        StepStats total;
+        std::mutex statsMutex;
+        parallelFor(0, bands, [this, band, &newCave, &total, &statsMutex](int first, int last) {
+            StepStats stats;
+            stepColumns(first * band, std::min(last * band, width), newCave, collectStats ? &stats : nullptr);
+            if (collectStats) {
+                std::lock_guard<std::mutex> lock(statsMutex);
+                total.add(stats);
+            }
+        }, stepConfig.workers);
+        if (collectStats) lastStats = total;
+
+        cave = newCave;
+        if (trackFlips) flips.update(PackedGrid::fromCave(cave, true));
+        generation++;
+        publish();
+    }
+
+    const std::vector<std::vector<bool>>& getCave() const {
+        return cave;
+    }
+
+    /**
+     * @brief Publish every generation in a named shared-memory segment
+     * @param name Segment name, e.g. "/cave"
+     * @return true if the segment was created
+     *
+     * Readers map the segment and read the packed grid in place, see
+     * SharedCaveHeader. Copies of the generator share the segment; call
+     * disableSharedMemory() on copies that should not publish.
+     */
+
+    bool enableSharedMemory(const std::string& name) {
+        std::shared_ptr<SharedCavePublisher> segment(new SharedCavePublisher());
+        if (!segment->open(name, width, height)) return false;
+        publisher = segment;
+        publish();
+        return true;
+    }
+
+    void disableSharedMemory() {
+        publisher.reset();
+    }
+
+    long long getGeneration() const { return generation; }
+
+    const StepConfig& getStepConfig() const { return stepConfig; }
+
+    /**
+     * @brief Count changes and neighbour totals in every simulateStep()
+     * @param enabled true to collect, false to skip the counting
+     */
+
+    void setStepStats(bool enabled) {
+        collectStats = enabled;
+        lastStats = StepStats();
+    }
+
+    /**
+     * @brief Counters of the last simulateStep() (zero if collection is off)
+     */
+
+    const StepStats& getStepStats() const { return lastStats; }
+
+    /**
+     * @brief Count how often each cell flips, see FlipHeatmap
+     * @param enabled true to start counting from the current cave, false to free the counters
+     */
+
+    void setFlipTracking(bool enabled) {
+        trackFlips = enabled;
+        if (enabled) {
+            restartFlips();
+        } else {
+            flips = FlipHeatmap();
+        }
+    }
+
+    const FlipHeatmap& getFlipHeatmap() const { return flips; }
+
+    void setStepConfig(const StepConfig& config) {
+        stepConfig = config;
+        stepConfig.workers = std::max(stepConfig.workers, 1);
+    }
+
+    /**
+     * @brief Replace the cave with an externally produced grid
+     * @param walls Alive cells, same size as the cave
+     * @param newGeneration Iteration number of the grid
+     *
+     * Only cells that differ are written and marked dirty, so a viewer
+     * mirroring another process uploads just the changed tiles.
+     */
+
+    void loadCave(const PackedGrid& walls, long long newGeneration) {
+        for (int x = 0; x < width && x < walls.getWidth(); x++) {
+            for (int y = 0; y < height && y < walls.getHeight(); y++) {
+                bool alive = walls.get(x, y);
+                if (alive != cave[x][y]) {
+                    cave[x][y] = alive;
+                    markDirty(x, y);
+                }
+            }
+        }
+        if (trackFlips) flips.update(walls);
+        generation = newGeneration;
+        publish();
+    }
+
+    /**
+     * @brief Areas changed since the last clearDirty() call
+     * @return Rectangles of whole tiles, neighbouring dirty tiles of a tile
+     *         row merged; clipped to the cave
+     */
+
+    std::vector<CaveRect> getDirtyRects() const {
+        std::vector<CaveRect> rects;
+        for (int ty = 0; ty < tilesY; ty++) {
+            int tx = 0;
+            while (tx < tilesX) {
+                if (!dirtyTiles[ty * tilesX + tx]) {
+                    tx++;
+                    continue;
+                }
+                int first = tx;
+                while (tx < tilesX && dirtyTiles[ty * tilesX + tx]) tx++;
+                int x0 = first * tileSize;
+                int y0 = ty * tileSize;
+                rects.push_back(CaveRect{x0, y0, std::min(tx * tileSize, width) - x0,
+                                         std::min(y0 + tileSize, height) - y0});
+            }
+        }
+        return rects;
+    }
+
+    /**
+     * @brief Forget the changed areas, e.g. after they have been drawn
+     */
+
+    void clearDirty() {
+        std::fill(dirtyTiles.begin(), dirtyTiles.end(), 0);
+    }
+
+    /**
+     * @brief Post-process walls with a morphological operation
+     * @param op Erode, dilate, open or close
+     * @param shape Square or disk structuring element
+     * @param radius Radius of the element
+     * @param workers Worker threads (0 - all hardware threads)
+     *
+     * Runs as a pipeline stage between simulateStep() calls; pinned cells
+     * keep their state.
+     */
+
+    void applyMorphology(MorphOp op, StructuringElement shape, int radius, int workers = 0) {
+        PackedGrid walls = morphologyGrid(PackedGrid::fromCave(cave, true), op, shape, radius, workers);
+        for (int x = 0; x < width; x++) {
+            for (int y = 0; y < height; y++) {
+                bool alive = walls.get(x, y);
+                cave[x][y] = isPinned() ? (alive || forceWall[x][y]) && !forceOpen[x][y] : alive;
+            }
+        }
+        if (trackFlips) flips.rebase(PackedGrid::fromCave(cave, true));
+        markAllDirty();
+        publish();
+    }
+
+    /**
+     * @brief Pin a cell as open space for the rest of the generation
+     * @param x X coordinate of the cell
+     * @param y Y coordinate of the cell
+     * @param enabled true to pin the cell, false to release it
+     *
+     * "Force open" wins over "force wall" when both are set.
+     */
+
+    void setForceOpen(int x, int y, bool enabled = true) {
+        if (x < 0 || x >= width || y < 0 || y >= height) return;
+        allocateMasks();
+        forceOpen[x][y] = enabled;
+        if (enabled) cave[x][y] = false;
+        markDirty(x, y);
+    }
+
+    /**
+     * @brief Pin a cell as wall for the rest of the generation
+     * @param x X coordinate of the cell
+     * @param y Y coordinate of the cell
+     * @param enabled true to pin the cell, false to release it
+     */
+
+    void setForceWall(int x, int y, bool enabled = true) {
+        if (x < 0 || x >= width || y < 0 || y >= height) return;
+        allocateMasks();
+        forceWall[x][y] = enabled;
+        if (enabled && !forceOpen[x][y]) cave[x][y] = true;
+        markDirty(x, y);
+    }
+
+    /**
+     * @brief Release all pinned cells and free their masks
+     */
+
+    void clearConstraints() {
+        std::vector<std::vector<bool>>().swap(forceOpen);
+        std::vector<std::vector<bool>>().swap(forceWall);
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    double getBirthChance() const { return birthChance; }
+    int getBirthLimit() const { return birthLimit; }
+    int getDeathLimit() const { return deathLimit; }
+    unsigned getSeed() const { return seed; }
+
+    void setBirthChance(double chance) { birthChance = chance; }
+    void setBirthLimit(int limit) { birthLimit = limit; }
+    void setDeathLimit(int limit) { deathLimit = limit; }
+
+    int getAliveCount() const {
+        int count = 0;
+        for (int x = 0; x < width; x++) {
+            for (int y = 0; y < height; y++) {
+                if (cave[x][y]) count++;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief Bytes currently used by the generator
+     */
+
+    MemoryFootprint getMemoryFootprint() const {
+        MemoryFootprint footprint = MemoryFootprint();
+        footprint.grid = cellGridBytes(cave);
+        footprint.history = cellGridBytes(initialCave) + flips.getMemoryBytes();
+        footprint.constraints = cellGridBytes(forceOpen) + cellGridBytes(forceWall);
+        footprint.dirtyTiles = dirtyTiles.capacity();
+        footprint.scratch = footprint.grid;
+        if (stepConfig.kernel == StepKernel::Columns) {
+            footprint.scratch += static_cast<size_t>(stepConfig.workers) * (height + 2);
+        }
+        footprint.shared = publisher ? publisher->getSize() : 0;
+        return footprint;
+    }
+
+    /**
+     * @brief Bytes a new generator of the given size needs, before pinning cells
+     * @param w Width of the cave
+     * @param h Height of the cave
+     * @param history Whether the starting noise is kept, see setKeepHistory()
+     */
+
+    static size_t estimateMemory(int w, int h, bool history = true) {
+        size_t column = sizeof(std::vector<bool>) + (static_cast<size_t>(h) + 63) / 64 * sizeof(uint64_t);
+        size_t tiles = static_cast<size_t>((w + 31) / 32) * ((h + 31) / 32);
+        return (history ? 3 : 2) * column * w + tiles;
+    }
+
+    /**
+     * @brief Keep a copy of the starting noise for resetToInitial()
+     * @param enabled false to free the copy; resetToInitial() then redraws
+     *        the noise from the seed
+     *
+     * Generators that never replay (batch workers) save a grid per cave.
+     */
+
+    void setKeepHistory(bool enabled) {
+        keepHistory = enabled;
+        if (!enabled) {
+            std::vector<std::vector<bool>>().swap(initialCave);
+        } else if (initialCave.empty()) {
+            initialCave = cave;
+        }
+    }
+};
+
+/**
+ * @struct CavePoint
+ * @brief Cell coordinates
+ */
+
+struct CavePoint {
+    int x, y;
+};
+
+/**
+ * @class RegionIndex
+ * @brief Constant-time rectangle queries over a generated cave
+ *
+ * Built once after generation. Holds a summed-area table of alive (wall)
+ * cells and, for every cell, the length of the open run that starts there
+ * and extends to the right. Rectangles are clipped to the cave bounds.
+ */
+
+class RegionIndex {
+private:
+    int width, height;
+    std::vector<int> summedArea;
+    std::vector<int> openRun;
+
+    int sumAt(int x, int y) const {
+        return summedArea[static_cast<size_t>(y) * (width + 1) + x];
+    }
+
+    bool clip(CaveRect& r) const {
+        int x0 = std::max(r.x, 0);
+        int y0 = std::max(r.y, 0);
+        int x1 = std::min(r.x + r.w, width);
+        int y1 = std::min(r.y + r.h, height);
+        if (x0 >= x1 || y0 >= y1) return false;
+        r.x = x0;
+        r.y = y0;
+        r.w = x1 - x0;
+        r.h = y1 - y0;
+        return true;
+    }
+
+public:
+
+    /**
+     * @brief Build the index from a cave grid
+     * @param generator Generator whose current cave is indexed
+     */
+
+    explicit RegionIndex(const CaveGenerator& generator)
+    : width(generator.getWidth()), height(generator.getHeight()) {
+        rebuild(generator);
+    }
+
+    /**
+     * @brief Recompute the tables after the cave has changed
+     * @param generator Generator whose current cave is indexed
+     */
+
+    void rebuild(const CaveGenerator& generator) {
+        const auto& cave = generator.getCave();
+        width = generator.getWidth();
+        height = generator.getHeight();
+
+        summedArea.assign(static_cast<size_t>(width + 1) * (height + 1), 0);
+        openRun.assign(static_cast<size_t>(width) * height, 0);
+
+        for (int y = 0; y < height; y++) {
+            int rowSum = 0;
+            int* above = &summedArea[static_cast<size_t>(y) * (width + 1)];
+            int* current = above + (width + 1);
+            for (int x = 0; x < width; x++) {
+                if (cave[x][y]) rowSum++;
+                current[x + 1] = above[x + 1] + rowSum;
+            }
+
+            int* runs = &openRun[static_cast<size_t>(y) * width];
+            int run = 0;
+            for (int x = width - 1; x >= 0; x--) {
+                run = cave[x][y] ? 0 : run + 1;
+                runs[x] = run;
+            }
+        }
+    }
+
+    /**
+     * @brief Number of alive cells inside a rectangle
+     * @param rect Rectangle to query
+     * @return Alive cell count of the clipped rectangle
+     */
+
+    int countAlive(CaveRect rect) const {
+        if (!clip(rect)) return 0;
+        int x1 = rect.x + rect.w;
+        int y1 = rect.y + rect.h;
+        return sumAt(x1, y1) - sumAt(rect.x, y1) - sumAt(x1, rect.y) + sumAt(rect.x, rect.y);
+    }
+
+    /**
+     * @brief Check that a rectangle contains no walls
+     * @param rect Rectangle to query
+     * @return true if the rectangle lies inside the cave and is fully open
+     */
+
+    bool isEmpty(const CaveRect& rect) const {
+        if (rect.w <= 0 || rect.h <= 0) return false;
+        if (rect.x < 0 || rect.y < 0 || rect.x + rect.w > width || rect.y + rect.h > height) {
+            return false;
+        }
+        return countAlive(rect) == 0;
+    }
+
+    /**
+     * @brief Fraction of alive cells inside a rectangle
+     * @param rect Rectangle to query
+     * @return Density in the range 0.0-1.0 (0.0 for empty intersections)
+     */
+
+    double density(CaveRect rect) const {
+        if (!clip(rect)) return 0.0;
+        return static_cast<double>(countAlive(rect)) / (static_cast<double>(rect.w) * rect.h);
+    }
+
+    /**
+     * @brief Length of the open run starting at a cell and going right
+     * @param x X coordinate of the cell
+     * @param y Y coordinate of the cell
+     * @return Number of consecutive open cells (0 if the cell is a wall)
+     */
+
+    int openRunLength(int x, int y) const {
+        if (x < 0 || x >= width || y < 0 || y >= height) return 0;
+        return openRun[static_cast<size_t>(y) * width + x];
+    }
+
+    /**
+     * @brief Batched alive counts
+     * @param rects Rectangles to query
+     * @param counts Output, resized to rects.size()
+     */
+
+    void countAlive(const std::vector<CaveRect>& rects, std::vector<int>& counts) const {
+        counts.resize(rects.size());
+        for (size_t i = 0; i < rects.size(); i++) {
+            counts[i] = countAlive(rects[i]);
+        }
+    }
+
+    /**
+     * @brief Batched emptiness checks
+     * @param rects Rectangles to query
+     * @param empty Output, resized to rects.size(); 1 if the rectangle is fully open
+     */
+
+    void isEmpty(const std::vector<CaveRect>& rects, std::vector<char>& empty) const {
+        empty.resize(rects.size());
+        for (size_t i = 0; i < rects.size(); i++) {
+            empty[i] = isEmpty(rects[i]) ? 1 : 0;
+        }
+    }
+};
+
+/**
+ * @struct Placement
+ * @brief A prefab placed on the cave with its top-left corner at (x, y)
+ */
+
+struct Placement {
+    int prefab;
+    int x, y;
+};
+
+/**
+ * @class PrefabPlacer
+ * @brief Bit-parallel search of positions where prefab footprints fit
+ *
+ * A footprint is a PackedGrid whose set bits must land on open cells.
+ * Each footprint row is split into runs; a run of length L is matched
+ * against a whole cave row at once by AND-ing the row with itself
+ * shifted by 1, 2, 4, ... cells. The per-row results are then AND-ed
+ * vertically, giving a grid of valid top-left corners.
+ */
+
+class PrefabPlacer {
+private:
+    PackedGrid open;
+    int workers;
+
+    struct Run {
+        int start, length;
+    };
+
+    static std::vector<Run> rowRuns(const PackedGrid& footprint, int y) {
+        std::vector<Run> runs;
+        int x = 0;
+        int w = footprint.getWidth();
+        while (x < w) {
+            if (!footprint.get(x, y)) {
+                x++;
+                continue;
+            }
+            int start = x;
+            while (x < w && footprint.get(x, y)) x++;
+            runs.push_back(Run{start, x - start});
+        }
+        return runs;
+    }
+
+    // dst bit x = AND of src bits x .. x + length - 1
+    static void erodeRow(const uint64_t* src, uint64_t* dst, uint64_t* scratch, int words, int length) {
+        std::copy(src, src + words, dst);
+        int span = 1;
+        while (span * 2 <= length) {
+            shiftRowDown(dst, scratch, words, span);
+            for (int i = 0; i < words; i++) dst[i] &= scratch[i];
+            span *= 2;
+        }
+        if (span < length) {
+            shiftRowDown(dst, scratch, words, length - span);
+            for (int i = 0; i < words; i++) dst[i] &= scratch[i];
+        }
+    }
+
+    bool overlaps(const PackedGrid& occupied, const PackedGrid& footprint, int x, int y) const {
+        int offset = x & 63;
+        int base = x >> 6;
+        int limit = occupied.getWordsPerRow();
+        for (int fy = 0; fy < footprint.getHeight(); fy++) {
+            const uint64_t* fp = footprint.row(fy);
+            const uint64_t* occ = occupied.row(y + fy);
+            for (int i = 0; i < footprint.getWordsPerRow(); i++) {
+                if (!fp[i]) continue;
+                if (base + i < limit && (occ[base + i] & (fp[i] << offset))) return true;
+                if (offset && base + i + 1 < limit && (occ[base + i + 1] & (fp[i] >> (64 - offset)))) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void stamp(PackedGrid& occupied, const PackedGrid& footprint, int x, int y) const {
+        int offset = x & 63;
+        int base = x >> 6;
+        int limit = occupied.getWordsPerRow();
+        for (int fy = 0; fy < footprint.getHeight(); fy++) {
+            const uint64_t* fp = footprint.row(fy);
+            uint64_t* occ = occupied.row(y + fy);
+            for (int i = 0; i < footprint.getWordsPerRow(); i++) {
+                if (base + i < limit) occ[base + i] |= fp[i] << offset;
+                if (offset && base + i + 1 < limit) occ[base + i + 1] |= fp[i] >> (64 - offset);
+            }
+        }
+    }
+
+public:
+
+    /**
+     * @brief Constructor for PrefabPlacer
+     * @param generator Generator whose current cave is used
+     * @param threads Worker threads for scanning (0 - all hardware threads)
+     */
+
+    explicit PrefabPlacer(const CaveGenerator& generator, int threads = 0)
+    : open(PackedGrid::fromCave(generator.getCave(), false)), workers(threads) {}
+
+    /**
+     * @brief Find every top-left corner where a footprint fits on open cells
+     * @param footprint Cells the prefab needs to be open
+     * @return Grid with a bit set for each valid corner
+     */
+
+    PackedGrid findValidPositions(const PackedGrid& footprint) const {
+        int w = open.getWidth();
+        int h = open.getHeight();
+        int fw = footprint.getWidth();
+        int fh = footprint.getHeight();
+        PackedGrid valid(w, h);
+        if (fw <= 0 || fh <= 0 || fw > w || fh > h) return valid;
+
+        int words = open.getWordsPerRow();
+
+        // Every distinct footprint row is matched against every cave row once
+        std::vector<int> patternOf(fh);
+        std::vector<std::vector<Run>> patterns;
+        for (int fy = 0; fy < fh; fy++) {
+            std::vector<Run> runs = rowRuns(footprint, fy);
+            size_t p = 0;
+            while (p < patterns.size()) {
+                const std::vector<Run>& other = patterns[p];
+                bool same = other.size() == runs.size();
+                for (size_t i = 0; same && i < runs.size(); i++) {
+                    same = other[i].start == runs[i].start && other[i].length == runs[i].length;
+                }
+                if (same) break;
+                p++;
+            }
+            if (p == patterns.size()) patterns.push_back(runs);
+            patternOf[fy] = static_cast<int>(p);
+        }
+
+        std::vector<PackedGrid> matched(patterns.size(), PackedGrid(w, h));
+        const PackedGrid& source = open;
+        parallelFor(0, h, [&](int rowBegin, int rowEnd) {
+            std::vector<uint64_t> eroded(words), shifted(words), scratch(words);
+            for (size_t p = 0; p < patterns.size(); p++) {
+                for (int y = rowBegin; y < rowEnd; y++) {
+                    uint64_t* out = matched[p].row(y);
+                    std::fill(out, out + words, ~uint64_t(0));
+                    for (const Run& run : patterns[p]) {
+                        erodeRow(source.row(y), eroded.data(), scratch.data(), words, run.length);
+                        shiftRowDown(eroded.data(), shifted.data(), words, run.start);
+                        for (int i = 0; i < words; i++) out[i] &= shifted[i];
+                    }
+                }
+            }
+        }, workers);
+
+        // Corners past w - fw would put the prefab outside the cave
+        PackedGrid inRange(w, 1);
+        for (int x = 0; x <= w - fw; x++) inRange.set(x, 0, true);
+
+        parallelFor(0, h - fh + 1, [&](int rowBegin, int rowEnd) {
+            for (int y = rowBegin; y < rowEnd; y++) {
+                uint64_t* out = valid.row(y);
+                std::copy(inRange.row(0), inRange.row(0) + words, out);
+                for (int fy = 0; fy < fh; fy++) {
+                    const uint64_t* m = matched[patternOf[fy]].row(y + fy);
+                    uint64_t any = 0;
+                    for (int i = 0; i < words; i++) {
+                        out[i] &= m[i];
+                        any |= out[i];
+                    }
+                    if (!any) break;
+                }
+            }
+        }, workers);
+
+        return valid;
+    }
+
+    /**
+     * @brief Find valid corners for several footprints
+     * @param footprints Prefab footprints
+     * @return One grid of valid corners per footprint
+     */
+
+    std::vector<PackedGrid> findValidPositions(const std::vector<PackedGrid>& footprints) const {
+        std::vector<PackedGrid> result;
+        result.reserve(footprints.size());
+        for (const PackedGrid& footprint : footprints) {
+            result.push_back(findValidPositions(footprint));
+        }
+        return result;
+    }
+
+    /**
+     * @brief Place prefabs greedily in scan order without overlap
+     * @param footprints Prefab footprints, placed in the given order
+     * @param maxPerPrefab Limit of placements per prefab (0 - unlimited)
+     * @return Accepted placements
+     */
+
+    std::vector<Placement> placeGreedy(const std::vector<PackedGrid>& footprints, int maxPerPrefab = 0) const {
+        std::vector<Placement> placements;
+        std::vector<PackedGrid> candidates = findValidPositions(footprints);
+        PackedGrid occupied(open.getWidth(), open.getHeight());
+
+        for (size_t p = 0; p < footprints.size(); p++) {
+            int placed = 0;
+            bool full = false;
+            const PackedGrid& valid = candidates[p];
+            for (int y = 0; y < valid.getHeight() && !full; y++) {
+                const uint64_t* row = valid.row(y);
+                for (int i = 0; i < valid.getWordsPerRow() && !full; i++) {
+                    uint64_t bits = row[i];
+                    while (bits && !full) {
+                        int x = i * 64 + __builtin_ctzll(bits);
+                        bits &= bits - 1;
+                        if (overlaps(occupied, footprints[p], x, y)) continue;
+                        stamp(occupied, footprints[p], x, y);
+                        placements.push_back(Placement{static_cast<int>(p), x, y});
+                        full = maxPerPrefab > 0 && ++placed >= maxPerPrefab;
+                    }
+                }
+            }
+        }
+        return placements;
+    }
+};
+
+/**
+ * @brief Fill set bits along runs of open bits towards higher x
+ * @param seed Starting bits (must be a subset of open)
+ * @param open Bits that may be filled
+ * @return Seed extended over the open runs it touches, upwards only
+ */
+
+inline uint64_t fillRunsUp(uint64_t seed, uint64_t open) {
+    uint64_t gen = seed;
+    uint64_t pro = open;
+    gen |= pro & (gen << 1);  pro &= pro << 1;
+    gen |= pro & (gen << 2);  pro &= pro << 2;
+    gen |= pro & (gen << 4);  pro &= pro << 4;
+    gen |= pro & (gen << 8);  pro &= pro << 8;
+    gen |= pro & (gen << 16); pro &= pro << 16;
+    gen |= pro & (gen << 32);
+    return gen;
+}
+
+/**
+ * @brief Fill set bits along runs of open bits towards lower x
+ * @param seed Starting bits (must be a subset of open)
+ * @param open Bits that may be filled
+ * @return Seed extended over the open runs it touches, downwards only
+ */
+
+inline uint64_t fillRunsDown(uint64_t seed, uint64_t open) {
+    uint64_t gen = seed;
+    uint64_t pro = open;
+    gen |= pro & (gen >> 1);  pro &= pro >> 1;
+    gen |= pro & (gen >> 2);  pro &= pro >> 2;
+    gen |= pro & (gen >> 4);  pro &= pro >> 4;
+    gen |= pro & (gen >> 8);  pro &= pro >> 8;
+    gen |= pro & (gen >> 16); pro &= pro >> 16;
+    gen |= pro & (gen >> 32);
+    return gen;
+}
+
+/**
+ * @brief Cells reachable from a set of sources through open cells
+ * @param open Walkable cells
+ * @param sources Starting cells (sources on walls are ignored)
+ * @param tileRows Height of a tile in rows; a tile is one word wide
+ * @return Grid of reachable cells (4-connected)
+ *
+ * The reached set is grown a whole word at a time: every row word takes
+ * the reached bits of the words above, below and beside it, masked by the
+ * open bits, and is then filled along its open runs. Work is organised
+ * in tiles with a worklist: a tile is revisited only when a neighbour
+ * changed the bits on their shared border, so settled parts of the map
+ * cost nothing once the front has passed them.
+ */
+
+inline PackedGrid computeReachable(const PackedGrid& open, const std::vector<CavePoint>& sources, int tileRows = 64) {
+    int w = open.getWidth();
+    int h = open.getHeight();
+    int words = open.getWordsPerRow();
+    PackedGrid reach(w, h);
+    if (w <= 0 || h <= 0) return reach;
+    if (tileRows < 1) tileRows = 1;
+
+    int tilesDown = (h + tileRows - 1) / tileRows;
+    std::vector<char> queued(static_cast<size_t>(tilesDown) * words, 0);
+    std::vector<int> worklist;
+
+    auto activate = [&](int ty, int wx) {
+        if (ty < 0 || ty >= tilesDown || wx < 0 || wx >= words) return;
+        int tile = ty * words + wx;
+        if (!queued[tile]) {
+            queued[tile] = 1;
+            worklist.push_back(tile);
+        }
+    };
+
+    for (const CavePoint& p : sources) {
+        if (p.x < 0 || p.x >= w || p.y < 0 || p.y >= h || !open.get(p.x, p.y)) continue;
+        reach.set(p.x, p.y, true);
+        activate(p.y / tileRows, p.x >> 6);
+    }
+
+    while (!worklist.empty()) {
+        int tile = worklist.back();
+        worklist.pop_back();
+        queued[tile] = 0;
+
+        int ty = tile / words;
+        int wx = tile % words;
+        int y0 = ty * tileRows;
+        int y1 = std::min(y0 + tileRows, h);
+
+        uint64_t changedBits = 0;
+        bool topChanged = false;
+        bool bottomChanged = false;
+        bool changed = true;
+
+        while (changed) {
+            changed = false;
+            for (int pass = 0; pass < 2; pass++) {
+                for (int i = 0; i < y1 - y0; i++) {
+                    int y = pass == 0 ? y0 + i : y1 - 1 - i;
+                    uint64_t o = open.row(y)[wx];
+                    if (!o) continue;
+
+                    uint64_t* r = reach.row(y);
+                    uint64_t seed = r[wx];
+                    if (y > 0) seed |= reach.row(y - 1)[wx];
+                    if (y + 1 < h) seed |= reach.row(y + 1)[wx];
+                    if (wx > 0) seed |= r[wx - 1] >> 63;
+                    if (wx + 1 < words) seed |= r[wx + 1] << 63;
+                    seed &= o;
+
+                    uint64_t filled = fillRunsUp(seed, o) | fillRunsDown(seed, o);
+                    uint64_t diff = filled ^ r[wx];
+                    if (diff) {
+                        r[wx] = filled;
+                        changedBits |= diff;
+                        if (y == y0) topChanged = true;
+                        if (y == y1 - 1) bottomChanged = true;
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        if (topChanged) activate(ty - 1, wx);
+        if (bottomChanged) activate(ty + 1, wx);
+        if (changedBits & 1) activate(ty, wx - 1);
+        if (changedBits >> 63) activate(ty, wx + 1);
+    }
+
+    return reach;
+}
+
+/**
+ * @brief Cells of a cave reachable from a set of sources
+ * @param generator Generator whose current cave is used
+ * @param sources Starting cells
+ * @return Grid of reachable open cells (4-connected)
+ */
+
+inline PackedGrid computeReachable(const CaveGenerator& generator, const std::vector<CavePoint>& sources) {
+    return computeReachable(PackedGrid::fromCave(generator.getCave(), false), sources);
+}
+
+/**
+ * @struct SightQuery
+ * @brief Line-of-sight request between two cells
+ */
+
+struct SightQuery {
+    CavePoint from, to;
+};
+
+/**
+ * @struct FieldOfView
+ * @brief Visible cells of one viewer, reusable between queries
+ *
+ * Remembers the rows the last query may have set, so the next query
+ * clears only those instead of the whole map.
+ */
+
+struct FieldOfView {
+    PackedGrid cells;   ///< Visible cells, map-sized
+    int rowBegin;       ///< First row the last query may have set
+    int rowEnd;         ///< One past the last such row
+
+    FieldOfView() : rowBegin(0), rowEnd(0) {}
+};
+
+/**
+ * @class VisibilityQuery
+ * @brief Field of view and line of sight over a generated cave
+ *
+ * Walls (alive cells) block sight; cells outside the cave are treated as
+ * walls. Queries only read the packed wall grid, so one instance can serve
+ * many viewers from several threads at once.
+ */
+
+class VisibilityQuery {
+private:
+    PackedGrid walls;
+
+    bool opaque(int x, int y) const {
+        if (x < 0 || x >= walls.getWidth() || y < 0 || y >= walls.getHeight()) return true;
+        return walls.get(x, y);
+    }
+
+    // Recursive shadowcasting over one octant
+    void castLight(int cx, int cy, int row, double start, double end, int radius,
+                   int xx, int xy, int yx, int yy, PackedGrid& visible) const {
+        if (start < end) return;
+        int radius2 = radius * radius;
+        double newStart = 0.0;
+
+        for (int j = row; j <= radius; j++) {
+            int dy = -j;
+            bool blocked = false;
+
+            for (int dx = -j; dx <= 0; dx++) {
+                int x = cx + dx * xx + dy * xy;
+                int y = cy + dx * yx + dy * yy;
+                double leftSlope = (dx - 0.5) / (dy + 0.5);
+                double rightSlope = (dx + 0.5) / (dy - 0.5);
+
+                if (start < rightSlope) continue;
+                if (end > leftSlope) break;
+
+                bool inside = x >= 0 && x < walls.getWidth() && y >= 0 && y < walls.getHeight();
+                if (inside && dx * dx + dy * dy <= radius2) {
+                    visible.set(x, y, true);
+                }
+
+                bool wall = opaque(x, y);
+                if (blocked) {
+                    if (wall) {
+                        newStart = rightSlope;
+                    } else {
+                        blocked = false;
+                        start = newStart;
+                    }
+                } else if (wall && j < radius) {
+                    blocked = true;
+                    castLight(cx, cy, j + 1, start, leftSlope, radius, xx, xy, yx, yy, visible);
+                    newStart = rightSlope;
+                }
+            }
+
+            if (blocked) break;
+        }
+    }
+
+public:
+
+    /**
+     * @brief Constructor for VisibilityQuery
+     * @param generator Generator whose current cave is used
+     */
+
+    explicit VisibilityQuery(const CaveGenerator& generator)
+    : walls(PackedGrid::fromCave(generator.getCave(), true)) {}
+
+    /**
+     * @brief Compute the cells visible from a viewer
+     * @param viewer Viewer position
+     * @param radius Sight radius in cells
+     * @param fov Output, reused between calls; only the rows set by its
+     *        previous query are cleared, so the cost follows the radius
+     */
+
+    void computeFov(CavePoint viewer, int radius, FieldOfView& fov) const {
+        PackedGrid& visible = fov.cells;
+        if (visible.getWidth() != walls.getWidth() || visible.getHeight() != walls.getHeight()) {
+            visible = PackedGrid(walls.getWidth(), walls.getHeight());
+        } else {
+            for (int y = fov.rowBegin; y < fov.rowEnd; y++) {
+                std::fill(visible.row(y), visible.row(y) + visible.getWordsPerRow(), 0);
+            }
+        }
+        fov.rowBegin = fov.rowEnd = 0;
+        if (viewer.x < 0 || viewer.x >= walls.getWidth() || viewer.y < 0 || viewer.y >= walls.getHeight()) {
+            return;
+        }
+        fov.rowBegin = std::max(viewer.y - radius, 0);
+        fov.rowEnd = std::min(viewer.y + radius + 1, walls.getHeight());
+
+        visible.set(viewer.x, viewer.y, true);
+
+        static const int octants[8][4] = {
+            { 1,  0,  0,  1}, { 0,  1,  1,  0}, { 0, -1,  1,  0}, {-1,  0,  0,  1},
+            {-1,  0,  0, -1}, { 0, -1, -1,  0}, { 0,  1, -1,  0}, { 1,  0,  0, -1}
+        };
+        for (int i = 0; i < 8; i++) {
+            castLight(viewer.x, viewer.y, 1, 1.0, 0.0, radius,
+                      octants[i][0], octants[i][1], octants[i][2], octants[i][3], visible);
+        }
+    }
+
+    /**
+     * @brief Compute fields of view for many viewers in parallel
+     * @param viewers Viewer positions
+     * @param radius Sight radius in cells
+     * @param visible Outputs, one per viewer; resized and reused between calls
+     * @param workers Worker threads (0 - all hardware threads)
+     */
+
+    void computeFov(const std::vector<CavePoint>& viewers, int radius,
+                    std::vector<FieldOfView>& visible, int workers = 0) const {
+        visible.resize(viewers.size());
+        parallelFor(0, static_cast<int>(viewers.size()), [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                computeFov(viewers[i], radius, visible[i]);
+            }
+        }, workers);
+    }
+
+    /**
+     * @brief Check whether two cells can see each other
+     * @param from First cell
+     * @param to Second cell
+     * @return true if no wall lies strictly between the cells on a Bresenham line
+     */
+
+    bool lineOfSight(CavePoint from, CavePoint to) const {
+        int dx = std::abs(to.x - from.x);
+        int dy = -std::abs(to.y - from.y);
+        int sx = from.x < to.x ? 1 : -1;
+        int sy = from.y < to.y ? 1 : -1;
+        int err = dx + dy;
+        int x = from.x;
+        int y = from.y;
+
+        while (x != to.x || y != to.y) {
+            int e2 = 2 * err;
+            if (e2 >= dy) {
+                err += dy;
+                x += sx;
+            }
+            if (e2 <= dx) {
+                err += dx;
+                y += sy;
+            }
+            if ((x != to.x || y != to.y) && opaque(x, y)) return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Batched line-of-sight checks
+     * @param queries Pairs of cells to test
+     * @param result Output, resized to queries.size(); 1 if the pair can see each other
+     * @param workers Worker threads (0 - all hardware threads)
+     */
+
+    void lineOfSight(const std::vector<SightQuery>& queries, std::vector<char>& result, int workers = 0) const {
+        result.resize(queries.size());
+        parallelFor(0, static_cast<int>(queries.size()), [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                result[i] = lineOfSight(queries[i].from, queries[i].to) ? 1 : 0;
+            }
+        }, workers);
+    }
+};
+
+/**
+ * @class FlowField
+ * @brief Distance-to-goal map with a step direction for every cell
+ *
+ * Distances are in octile units: an orthogonal step costs 2 and a
+ * diagonal step costs 3. Diagonal steps are only allowed when both
+ * orthogonal cells next to them are open, so agents never cut corners.
+ */
+
+class FlowField {
+private:
+    int width, height;
+    std::vector<int> distance;
+    std::vector<signed char> direction;
+
+    static const int stepX[8];
+    static const int stepY[8];
+    static const int stepCost[8];
+
+public:
+    static const int unreachable = -1;
+
+    FlowField() : width(0), height(0) {}
+
+    /**
+     * @brief Compute the field with a bucket-queue Dijkstra from all goals at once
+     * @param open Walkable cells
+     * @param goals Goal cells (goals on walls are ignored)
+     * @param workers Worker threads for the direction pass (0 - all hardware threads)
+     */
+
+    void compute(const PackedGrid& open, const std::vector<CavePoint>& goals, int workers = 0) {
+        width = open.getWidth();
+        height = open.getHeight();
+        size_t cells = static_cast<size_t>(width) * height;
+        distance.assign(cells, unreachable);
+        direction.assign(cells, -1);
+
+        // Edge costs are at most 3, so four circular buckets are enough
+        std::vector<int> buckets[4];
+        for (const CavePoint& g : goals) {
+            if (g.x < 0 || g.x >= width || g.y < 0 || g.y >= height || !open.get(g.x, g.y)) continue;
+            int index = g.y * width + g.x;
+            if (distance[index] == 0) continue;
+            distance[index] = 0;
+            buckets[0].push_back(index);
+        }
+
+        int current = 0;
+        int pending = static_cast<int>(buckets[0].size());
+        while (pending > 0) {
+            std::vector<int>& bucket = buckets[current & 3];
+            for (size_t i = 0; i < bucket.size(); i++) {
+                int index = bucket[i];
+                pending--;
+                if (distance[index] != current) continue;
+
+                int x = index % width;
+                int y = index / width;
+                for (int d = 0; d < 8; d++) {
+                    int nx = x + stepX[d];
+                    int ny = y + stepY[d];
+                    if (nx < 0 || nx >= width || ny < 0 || ny >= height || !open.get(nx, ny)) continue;
+                    if (stepX[d] && stepY[d] && (!open.get(nx, y) || !open.get(x, ny))) continue;
+
+                    int next = ny * width + nx;
+                    int cost = current + stepCost[d];
+                    if (distance[next] == unreachable || cost < distance[next]) {
+                        distance[next] = cost;
+                        buckets[cost & 3].push_back(next);
+                        pending++;
+                    }
+                }
+            }
+            bucket.clear();
+            current++;
+        }
+
+        parallelFor(0, height, [&](int rowBegin, int rowEnd) {
+            for (int y = rowBegin; y < rowEnd; y++) {
+                for (int x = 0; x < width; x++) {
+                    int index = y * width + x;
+                    if (distance[index] <= 0) continue;
+                    int best = distance[index];
+                    for (int d = 0; d < 8; d++) {
+                        int nx = x + stepX[d];
+                        int ny = y + stepY[d];
+                        if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+                        if (stepX[d] && stepY[d] && (!open.get(nx, y) || !open.get(x, ny))) continue;
+                        int nd = distance[ny * width + nx];
+                        if (nd != unreachable && nd < best) {
+                            best = nd;
+                            direction[index] = static_cast<signed char>(d);
+                        }
+                    }
+                }
+            }
+        }, workers);
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    /**
+     * @brief Distance from a cell to the nearest goal
+     * @return Distance in octile units, or FlowField::unreachable
+     */
+
+    int getDistance(int x, int y) const {
+        if (x < 0 || x >= width || y < 0 || y >= height) return unreachable;
+        return distance[static_cast<size_t>(y) * width + x];
+    }
+
+    /**
+     * @brief Step towards the nearest goal
+     * @return Offset (-1..1, -1..1); (0, 0) on goals and unreachable cells
+     */
+
+    CavePoint getDirection(int x, int y) const {
+        if (x < 0 || x >= width || y < 0 || y >= height) return CavePoint{0, 0};
+        int d = direction[static_cast<size_t>(y) * width + x];
+        if (d < 0) return CavePoint{0, 0};
+        return CavePoint{stepX[d], stepY[d]};
+    }
+
+    const std::vector<int>& getDistances() const { return distance; }
+};
+
+const int FlowField::stepX[8] = {1, -1, 0, 0, 1, 1, -1, -1};
+const int FlowField::stepY[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+const int FlowField::stepCost[8] = {2, 2, 2, 2, 3, 3, 3, 3};
+const int FlowField::unreachable;
+
+/**
+ * @class FlowFieldCache
+ * @brief Flow fields cached per goal set and invalidated when cells change
+ *
+ * Changing a cell only drops the fields it can affect: a new wall matters
+ * to fields that reached that cell, a new opening matters to fields that
+ * reached one of its neighbours. Dropped fields are recomputed on the
+ * next request. Not thread-safe; use prepare() to fill the cache in parallel.
+ */
+
+class FlowFieldCache {
+private:
+    struct Entry {
+        std::vector<CavePoint> goals;
+        FlowField field;
+        bool valid;
+    };
+
+    PackedGrid open;
+    std::vector<std::unique_ptr<Entry>> entries;
+
+    static std::vector<CavePoint> normalize(std::vector<CavePoint> goals) {
+        std::sort(goals.begin(), goals.end(), [](const CavePoint& a, const CavePoint& b) {
+            return a.y != b.y ? a.y < b.y : a.x < b.x;
+        });
+        goals.erase(std::unique(goals.begin(), goals.end(), [](const CavePoint& a, const CavePoint& b) {
+            return a.x == b.x && a.y == b.y;
+        }), goals.end());
+        return goals;
+    }
+
+    Entry* find(const std::vector<CavePoint>& goals) {
+        for (auto& entry : entries) {
+            if (entry->goals.size() != goals.size()) continue;
+            bool same = true;
+            for (size_t i = 0; same && i < goals.size(); i++) {
+                same = entry->goals[i].x == goals[i].x && entry->goals[i].y == goals[i].y;
+            }
+            if (same) return entry.get();
+        }
+        return nullptr;
+    }
+
+    Entry* findOrAdd(const std::vector<CavePoint>& goals) {
+        Entry* entry = find(goals);
+        if (!entry) {
+            entries.push_back(std::unique_ptr<Entry>(new Entry{goals, FlowField(), false}));
+            entry = entries.back().get();
+        }
+        return entry;
+    }
+
+public:
+
+    /**
+     * @brief Constructor for FlowFieldCache
+     * @param generator Generator whose current cave is used
+     */
+
+    explicit FlowFieldCache(const CaveGenerator& generator)
+    : open(PackedGrid::fromCave(generator.getCave(), false)) {}
+
+    /**
+     * @brief Get the flow field for a goal set, computing it if needed
+     * @param goals Goal cells (order and duplicates do not matter)
+     * @return Field valid until the next call that changes the cache
+     */
+
+    const FlowField& get(const std::vector<CavePoint>& goals) {
+        Entry* entry = findOrAdd(normalize(goals));
+        if (!entry->valid) {
+            entry->field.compute(open, entry->goals, 1);
+            entry->valid = true;
+        }
+        return entry->field;
+    }
+
+    /**
+     * @brief Compute all missing fields for several goal sets in parallel
+     * @param goalSets Goal sets to have ready
+     * @param workers Worker threads (0 - all hardware threads)
+     */
+
+    void prepare(const std::vector<std::vector<CavePoint>>& goalSets, int workers = 0) {
+        std::vector<Entry*> stale;
+        for (const auto& goals : goalSets) {
+            Entry* entry = findOrAdd(normalize(goals));
+            if (!entry->valid && std::find(stale.begin(), stale.end(), entry) == stale.end()) {
+                stale.push_back(entry);
+            }
+        }
+        parallelFor(0, static_cast<int>(stale.size()), [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                stale[i]->field.compute(open, stale[i]->goals, 1);
+                stale[i]->valid = true;
+            }
+        }, workers);
+    }
+
+    /**
+     * @brief Change a cell and invalidate the fields it affects
+     * @param x X coordinate of the cell
+     * @param y Y coordinate of the cell
+     * @param wall New state of the cell
+     */
+
+    void setCell(int x, int y, bool wall) {
+        if (x < 0 || x >= open.getWidth() || y < 0 || y >= open.getHeight()) return;
+        if (open.get(x, y) == !wall) return;
+        open.set(x, y, !wall);
+
+        for (auto& entry : entries) {
+            if (!entry->valid) continue;
+            const FlowField& field = entry->field;
+            bool affected = false;
+            if (wall) {
+                affected = field.getDistance(x, y) != FlowField::unreachable;
+            } else {
+                for (int dy = -1; dy <= 1 && !affected; dy++) {
+                    for (int dx = -1; dx <= 1 && !affected; dx++) {
+                        affected = field.getDistance(x + dx, y + dy) != FlowField::unreachable;
+                    }
+                }
+            }
+            if (affected) entry->valid = false;
+        }
+    }
+
+    /**
+     * @brief Drop all cached fields
+     */
+
+    void clear() {
+        entries.clear();
+    }
+};
+
+/**
+ * @brief Chessboard distance from every open cell to the nearest wall
+ * @param open Open cells
+ * @return Row-major distances: 0 on walls, 1 next to a wall, and so on;
+ *         cells outside the grid count as walls
+ */
+
+inline std::vector<int> computeDistanceTransform(const PackedGrid& open) {
+    int w = open.getWidth();
+    int h = open.getHeight();
+    std::vector<int> dist(static_cast<size_t>(w) * h, 0);
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            if (!open.get(x, y)) continue;
+            int d = 1;
+            if (x > 0 && y > 0) {
+                d = std::min(std::min(dist[(y - 1) * w + x - 1], dist[(y - 1) * w + x]),
+                             std::min(x + 1 < w ? dist[(y - 1) * w + x + 1] : 0, dist[y * w + x - 1])) + 1;
+            }
+            dist[y * w + x] = d;
+        }
+    }
+    for (int y = h - 1; y >= 0; y--) {
+        for (int x = w - 1; x >= 0; x--) {
+            int& d = dist[y * w + x];
+            if (!d) continue;
+            if (x + 1 >= w || y + 1 >= h) {
+                d = 1;
+                continue;
+            }
+            int below = std::min(std::min(x > 0 ? dist[(y + 1) * w + x - 1] : 0, dist[(y + 1) * w + x]),
+                                 std::min(dist[(y + 1) * w + x + 1], dist[y * w + x + 1]));
+            d = std::min(d, below + 1);
+        }
+    }
+    return dist;
+}
+
+/**
+ * @brief Thin open space down to a one-cell-wide skeleton
+ * @param open Open cells
+ * @param workers Worker threads (0 - all hardware threads)
+ * @return Skeleton cells
+ *
+ * Zhang-Suen thinning. Each sub-iteration only reads the previous state,
+ * so the deletion marks are computed for row bands in parallel and then
+ * applied together.
+ */
+
+inline PackedGrid skeletonize(const PackedGrid& open, int workers = 0) {
+    int w = open.getWidth();
+    int h = open.getHeight();
+    std::vector<unsigned char> cells(static_cast<size_t>(w) * h, 0);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            cells[y * w + x] = open.get(x, y) ? 1 : 0;
+        }
+    }
+
+    auto at = [&](int x, int y) -> int {
+        return (x >= 0 && x < w && y >= 0 && y < h) ? cells[y * w + x] : 0;
+    };
+
+    std::vector<unsigned char> remove(cells.size(), 0);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int pass = 0; pass < 2; pass++) {
+            std::atomic<bool> marked(false);
+            parallelFor(0, h, [&](int rowBegin, int rowEnd) {
+                bool any = false;
+                for (int y = rowBegin; y < rowEnd; y++) {
+                    for (int x = 0; x < w; x++) {
+                        remove[y * w + x] = 0;
+                        if (!cells[y * w + x]) continue;
+
+                        int p[8] = {
+                            at(x, y - 1), at(x + 1, y - 1), at(x + 1, y), at(x + 1, y + 1),
+                            at(x, y + 1), at(x - 1, y + 1), at(x - 1, y), at(x - 1, y - 1)
+                        };
+                        int neighbours = 0;
+                        int transitions = 0;
+                        for (int i = 0; i < 8; i++) {
+                            neighbours += p[i];
+                            if (!p[i] && p[(i + 1) & 7]) transitions++;
+                        }
+                        if (neighbours < 2 || neighbours > 6 || transitions != 1) continue;
+
+                        bool first = pass == 0
+                            ? !(p[0] && p[2] && p[4]) && !(p[2] && p[4] && p[6])
+                            : !(p[0] && p[2] && p[6]) && !(p[0] && p[4] && p[6]);
+                        if (first) {
+                            remove[y * w + x] = 1;
+                            any = true;
+                        }
+                    }
+                }
+                if (any) marked = true;
+            }, workers);
+
+            if (marked) {
+                changed = true;
+                for (size_t i = 0; i < cells.size(); i++) {
+                    if (remove[i]) cells[i] = 0;
+                }
+            }
+        }
+    }
+
+    PackedGrid skeleton(w, h);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            if (cells[y * w + x]) skeleton.set(x, y, true);
+        }
+    }
+    return skeleton;
+}
+
+/**
+ * @struct CorridorNode
+ * @brief Junction or dead end of the corridor graph
+ */
+
+struct CorridorNode {
+    int x, y;       ///< Cell of the node (first cell of a junction cluster)
+    int degree;     ///< Number of corridors leaving the node
+};
+
+/**
+ * @struct CorridorEdge
+ * @brief Corridor between two nodes of the corridor graph
+ */
+
+struct CorridorEdge {
+    int from, to;       ///< Node indices
+    int length;         ///< Skeleton cells along the corridor
+    int minWidth;       ///< Narrowest width in cells
+    double meanWidth;   ///< Average width in cells
+};
+
+/**
+ * @struct CorridorGraph
+ * @brief Level graph of junctions and the corridors between them
+ */
+
+struct CorridorGraph {
+    std::vector<CorridorNode> nodes;
+    std::vector<CorridorEdge> edges;
+};
+
+/**
+ * @brief Turn the open space of a cave into a graph of junctions and corridors
+ * @param open Open cells
+ * @param workers Worker threads for thinning (0 - all hardware threads)
+ * @return Corridor graph; widths come from the distance transform
+ *
+ * Skeleton cells whose neighbourhood does not form exactly two branches
+ * are nodes; touching node cells are merged into one junction. Each
+ * connected run of the remaining skeleton cells is one corridor, joining
+ * the junctions it touches. Closed loops without any junction get a node
+ * of their own. Touching node cells always end up in the same junction,
+ * so every corridor has at least one cell.
+ */
+
+inline CorridorGraph buildCorridorGraph(const PackedGrid& open, int workers = 0) {
+    int w = open.getWidth();
+    int h = open.getHeight();
+    PackedGrid skeleton = skeletonize(open, workers);
+    std::vector<int> dist = computeDistanceTransform(open);
+
+    static const int dx[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+    static const int dy[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+
+    auto on = [&](int x, int y) {
+        return x >= 0 && x < w && y >= 0 && y < h && skeleton.get(x, y);
+    };
+    auto branches = [&](int x, int y) {
+        int transitions = 0;
+        for (int i = 0; i < 8; i++) {
+            if (!on(x + dx[i], y + dy[i]) && on(x + dx[(i + 1) & 7], y + dy[(i + 1) & 7])) transitions++;
+        }
+        return transitions;
+    };
+    auto widthAt = [&](int index) {
+        return 2 * dist[index] - 1;
+    };
+
+    CorridorGraph graph;
+    std::vector<int> nodeOf(static_cast<size_t>(w) * h, -1);
+    std::vector<unsigned char> visited(static_cast<size_t>(w) * h, 0);
+
+    // Group node cells into junctions
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            if (!skeleton.get(x, y) || nodeOf[y * w + x] >= 0 || branches(x, y) == 2) continue;
+            int id = static_cast<int>(graph.nodes.size());
+            graph.nodes.push_back(CorridorNode{x, y, 0});
+            std::vector<int> stack(1, y * w + x);
+            nodeOf[y * w + x] = id;
+            while (!stack.empty()) {
+                int index = stack.back();
+                stack.pop_back();
+                int cx = index % w;
+                int cy = index / w;
+                for (int i = 0; i < 8; i++) {
+                    int nx = cx + dx[i];
+                    int ny = cy + dy[i];
+                    if (!on(nx, ny) || nodeOf[ny * w + nx] >= 0 || branches(nx, ny) == 2) continue;
+                    nodeOf[ny * w + nx] = id;
+                    stack.push_back(ny * w + nx);
+                }
+            }
+        }
+    }
+
+    // Every 8-connected run of corridor cells is one edge between the
+    // junctions it touches
+    std::vector<int> cells;
+    std::vector<std::pair<int, int>> attachments;  // (node, corridor cell)
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int seed = y * w + x;
+            if (!skeleton.get(x, y) || nodeOf[seed] >= 0 || visited[seed]) continue;
+
+            cells.assign(1, seed);
+            attachments.clear();
+            visited[seed] = 1;
+            int minWidth = widthAt(seed);
+            long long widthSum = 0;
+            for (size_t i = 0; i < cells.size(); i++) {
+                int index = cells[i];
+                int cx = index % w;
+                int cy = index / w;
+                minWidth = std::min(minWidth, widthAt(index));
+                widthSum += widthAt(index);
+                for (int k = 0; k < 8; k++) {
+                    int nx = cx + dx[k];
+                    int ny = cy + dy[k];
+                    if (!on(nx, ny)) continue;
+                    int next = ny * w + nx;
+                    if (nodeOf[next] >= 0) {
+                        attachments.push_back(std::make_pair(nodeOf[next], index));
+                    } else if (dx[k] && dy[k] && (nodeOf[cy * w + nx] >= 0 || nodeOf[ny * w + cx] >= 0)) {
+                        // Diagonal shortcut past a junction cell: arms meet only through the junction
+                        continue;
+                    } else if (!visited[next]) {
+                        visited[next] = 1;
+                        cells.push_back(next);
+                    }
+                }
+            }
+
+            int length = static_cast<int>(cells.size());
+            double meanWidth = static_cast<double>(widthSum) / length;
+            std::sort(attachments.begin(), attachments.end());
+            attachments.erase(std::unique(attachments.begin(), attachments.end()), attachments.end());
+
+            auto addEdge = [&](int from, int to) {
+                graph.edges.push_back(CorridorEdge{from, to, length, minWidth, meanWidth});
+                graph.nodes[from].degree++;
+                graph.nodes[to].degree++;
+            };
+
+            if (attachments.empty()) {
+                // Closed loop without junctions
+                int node = static_cast<int>(graph.nodes.size());
+                graph.nodes.push_back(CorridorNode{x, y, 0});
+                addEdge(node, node);
+                continue;
+            }
+
+            int first = attachments.front().first;
+            bool single = attachments.back().first == first;
+            if (single) {
+                // A loop back to the same junction leaves and re-enters it at
+                // cells that do not touch; a single attachment is only a notch
+                bool loop = false;
+                for (size_t i = 0; i < attachments.size() && !loop; i++) {
+                    for (size_t j = i + 1; j < attachments.size() && !loop; j++) {
+                        int a = attachments[i].second;
+                        int b = attachments[j].second;
+                        loop = std::abs(a % w - b % w) > 1 || std::abs(a / w - b / w) > 1;
+                    }
+                }
+                if (loop) addEdge(first, first);
+                continue;
+            }
+
+            // Two junctions normally; thicker skeleton spots may touch more
+            for (size_t i = 1; i < attachments.size(); i++) {
+                if (attachments[i].first != attachments[i - 1].first) addEdge(first, attachments[i].first);
+            }
+        }
+    }
+
+    return graph;
+}
+
+/**
+ * @struct Room
+ * @brief Open area separated from its neighbours by chokepoints
+ */
+
+struct Room {
+    int area;           ///< Cells in the room
+    int centerX;        ///< Cell farthest from any wall
+    int centerY;
+    int radius;         ///< Distance from the center to the nearest wall
+};
+
+/**
+ * @struct Chokepoint
+ * @brief Narrowest passage between two adjacent rooms
+ */
+
+struct Chokepoint {
+    int roomA, roomB;   ///< Room indices
+    int x, y;           ///< Cell at the passage
+    int width;          ///< Passage width in cells
+};
+
+/**
+ * @struct RoomGraph
+ * @brief Segmentation of a cave into rooms and the chokepoints between them
+ */
+
+struct RoomGraph {
+    int width, height;
+    std::vector<int> labels;                ///< Row-major room index per cell, -1 on walls
+    std::vector<Room> rooms;
+    std::vector<Chokepoint> chokepoints;    ///< One (the widest) per pair of adjacent rooms
+};
+
+/**
+ * @brief Split the open space of a cave into rooms joined by chokepoints
+ * @param open Open cells
+ * @param mergeRatio Two basins are kept apart only if the passage between them
+ *        is narrower than mergeRatio times the smaller basin's radius
+ * @return Rooms, chokepoints and per-cell room labels
+ *
+ * Watershed over the distance transform by priority-flood: cells are taken
+ * from the widest distance down with a bucket queue, plateaus are flooded
+ * from cells that already have a label, and every cell where two basins
+ * meet records the passage between them. Basins joined by a passage that
+ * is nearly as wide as the basins themselves are merged afterwards. Rooms
+ * are 4-connected, like movement.
+ */
+
+inline RoomGraph detectRooms(const PackedGrid& open, double mergeRatio = 0.75) {
+    int w = open.getWidth();
+    int h = open.getHeight();
+    std::vector<int> dist = computeDistanceTransform(open);
+    size_t cells = dist.size();
+
+    int maxDist = 0;
+    for (int d : dist) maxDist = std::max(maxDist, d);
+    std::vector<std::vector<int>> buckets(maxDist + 1);
+    for (size_t i = 0; i < cells; i++) {
+        if (dist[i] > 0) buckets[dist[i]].push_back(static_cast<int>(i));
+    }
+
+    struct Saddle {
+        int a, b, level, cell;
+    };
+
+    std::vector<int> label(cells, -1);
+    std::vector<unsigned char> queued(cells, 0);
+    std::vector<int> peakCell;
+    std::vector<Saddle> saddles;
+    std::vector<int> queue;
+
+    static const int dx[4] = {1, -1, 0, 0};
+    static const int dy[4] = {0, 0, 1, -1};
+
+    auto visit = [&](int cell) {
+        int x = cell % w;
+        int y = cell / w;
+        for (int i = 0; i < 4; i++) {
+            int nx = x + dx[i];
+            int ny = y + dy[i];
+            if (nx < 0 || nx >= w || ny < 0 || ny >= h) continue;
+            int n = ny * w + nx;
+            int other = label[n];
+            if (other >= 0) {
+                if (label[cell] < 0) {
+                    label[cell] = other;
+                } else if (other != label[cell]) {
+                    saddles.push_back(Saddle{std::min(other, label[cell]), std::max(other, label[cell]),
+                                             dist[cell], cell});
+                }
+            } else if (dist[n] == dist[cell] && !queued[n]) {
+                queued[n] = 1;
+                queue.push_back(n);
+            }
+        }
+    };
+
+    auto drain = [&]() {
+        for (size_t head = 0; head < queue.size(); head++) {
+            visit(queue[head]);
+        }
+        queue.clear();
+    };
+
+    for (int level = maxDist; level >= 1; level--) {
+        for (int cell : buckets[level]) {
+            int x = cell % w;
+            int y = cell / w;
+            for (int i = 0; i < 4; i++) {
+                int nx = x + dx[i];
+                int ny = y + dy[i];
+                if (nx >= 0 && nx < w && ny >= 0 && ny < h && label[ny * w + nx] >= 0) {
+                    queued[cell] = 1;
+                    queue.push_back(cell);
+                    break;
+                }
+            }
+        }
+        drain();
+
+        for (int cell : buckets[level]) {
+            if (label[cell] >= 0) continue;
+            label[cell] = static_cast<int>(peakCell.size());
+            peakCell.push_back(cell);
+            queued[cell] = 1;
+            visit(cell);
+            drain();
+        }
+    }
+
+    // Merge basins separated only by wide passages, widest passages first
+    std::vector<int> parent(peakCell.size());
+    std::vector<int> peak(peakCell.size());
+    for (size_t i = 0; i < parent.size(); i++) {
+        parent[i] = static_cast<int>(i);
+        peak[i] = dist[peakCell[i]];
+    }
+    auto root = [&](int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+
+    // Counting sort by level, widest first; levels are bounded by maxDist
+    std::vector<size_t> levelStart(maxDist + 2, 0);
+    for (const Saddle& s : saddles) levelStart[maxDist - s.level + 1]++;
+    for (int i = 1; i <= maxDist + 1; i++) levelStart[i] += levelStart[i - 1];
+    std::vector<Saddle> sorted(saddles.size());
+    for (const Saddle& s : saddles) sorted[levelStart[maxDist - s.level]++] = s;
+    saddles.swap(sorted);
+    for (const Saddle& s : saddles) {
+        int a = root(s.a);
+        int b = root(s.b);
+        if (a == b) continue;
+        if (s.level >= mergeRatio * std::min(peak[a], peak[b])) {
+            if (peak[a] < peak[b]) std::swap(a, b);
+            parent[b] = a;
+        }
+    }
+
+    RoomGraph graph;
+    graph.width = w;
+    graph.height = h;
+    graph.labels.assign(cells, -1);
+
+    std::vector<int> roomOf(peakCell.size(), -1);
+    for (size_t i = 0; i < peakCell.size(); i++) {
+        int r = root(static_cast<int>(i));
+        if (roomOf[r] < 0) {
+            roomOf[r] = static_cast<int>(graph.rooms.size());
+            graph.rooms.push_back(Room{0, peakCell[r] % w, peakCell[r] / w, peak[r]});
+        }
+    }
+    for (size_t i = 0; i < cells; i++) {
+        if (label[i] < 0) continue;
+        int room = roomOf[root(label[i])];
+        graph.labels[i] = room;
+        graph.rooms[room].area++;
+    }
+
+    // Saddles are sorted widest first, so the first one seen per pair wins
+    std::unordered_set<uint64_t> seen;
+    for (const Saddle& s : saddles) {
+        int a = roomOf[root(s.a)];
+        int b = roomOf[root(s.b)];
+        if (a == b) continue;
+        if (a > b) std::swap(a, b);
+        if (!seen.insert((static_cast<uint64_t>(a) << 32) | static_cast<uint32_t>(b)).second) continue;
+        graph.chokepoints.push_back(Chokepoint{a, b, s.cell % w, s.cell / w, 2 * s.level - 1});
+    }
+
+    return graph;
+}
+
+/**
+ * @brief Number of cells that differ between two grids of the same size
+ * @param a First grid
+ * @param b Second grid
+ * @return Popcount of a XOR b
+ */
+
+inline long long hammingDistance(const PackedGrid& a, const PackedGrid& b) {
+    long long total = 0;
+    for (int y = 0; y < a.getHeight(); y++) {
+        const uint64_t* ra = a.row(y);
+        const uint64_t* rb = b.row(y);
+        for (int i = 0; i < a.getWordsPerRow(); i++) {
+            total += __builtin_popcountll(ra[i] ^ rb[i]);
+        }
+    }
+    return total;
+}
+
+/**
+ * @brief Fraction of cells two grids of the same size agree on
+ * @return Similarity in the range 0.0-1.0
+ */
+
+inline double caveSimilarity(const PackedGrid& a, const PackedGrid& b) {
+    double cells = static_cast<double>(a.getWidth()) * a.getHeight();
+    if (cells <= 0.0) return 1.0;
+    return 1.0 - hammingDistance(a, b) / cells;
+}
+
+/**
+ * @struct CaveSignature
+ * @brief 256-bit perceptual hash of a cave
+ *
+ * The cave is cut into 16 x 16 blocks; a bit is set when its block holds
+ * more walls than the cave does on average. Similar caves get signatures
+ * with a small Hamming distance.
+ */
+
+struct CaveSignature {
+    uint64_t bits[4];
+
+    static CaveSignature compute(const PackedGrid& walls) {
+        const int blocks = 16;
+        CaveSignature signature = {{0, 0, 0, 0}};
+        int w = walls.getWidth();
+        int h = walls.getHeight();
+        if (w <= 0 || h <= 0) return signature;
+
+        std::vector<long long> counts(blocks * blocks, 0);
+        for (int y = 0; y < h; y++) {
+            const uint64_t* row = walls.row(y);
+            int by = static_cast<int>(static_cast<long long>(y) * blocks / h);
+            for (int bx = 0; bx < blocks; bx++) {
+                int x0 = static_cast<int>(static_cast<long long>(bx) * w / blocks);
+                int x1 = static_cast<int>(static_cast<long long>(bx + 1) * w / blocks);
+                long long count = 0;
+                for (int x = x0; x < x1;) {
+                    int offset = x & 63;
+                    int take = std::min(64 - offset, x1 - x);
+                    uint64_t mask = take == 64 ? ~uint64_t(0) : ((uint64_t(1) << take) - 1) << offset;
+                    count += __builtin_popcountll(row[x >> 6] & mask);
+                    x += take;
+                }
+                counts[by * blocks + bx] += count;
+            }
+        }
+
+        long long total = walls.count();
+        for (int by = 0; by < blocks; by++) {
+            int y0 = static_cast<int>(static_cast<long long>(by) * h / blocks);
+            int y1 = static_cast<int>(static_cast<long long>(by + 1) * h / blocks);
+            for (int bx = 0; bx < blocks; bx++) {
+                int x0 = static_cast<int>(static_cast<long long>(bx) * w / blocks);
+                int x1 = static_cast<int>(static_cast<long long>(bx + 1) * w / blocks);
+                long long area = static_cast<long long>(x1 - x0) * (y1 - y0);
+                // count / area > total / (w * h), kept in integers
+                if (counts[by * blocks + bx] * w * static_cast<long long>(h) > total * area) {
+                    int bit = by * blocks + bx;
+                    signature.bits[bit >> 6] |= uint64_t(1) << (bit & 63);
+                }
+            }
+        }
+        return signature;
+    }
+
+    int distance(const CaveSignature& other) const {
+        int d = 0;
+        for (int i = 0; i < 4; i++) d += __builtin_popcountll(bits[i] ^ other.bits[i]);
+        return d;
+    }
+};
+
+/**
+ * @class CaveDeduplicator
+ * @brief Drops near-identical caves from a batch
+ *
+ * Signatures are split into eight 32-bit bands and indexed by band value
+ * (locality-sensitive hashing): only caves that share at least one band
+ * with an earlier cave are compared, first by signature and then by an
+ * exact XOR popcount of the grids.
+ */
+
+class CaveDeduplicator {
+private:
+    double threshold;
+    int signatureRadius;
+    std::vector<PackedGrid> kept;
+    std::vector<CaveSignature> signatures;
+    std::vector<std::unordered_map<uint32_t, std::vector<int>>> bands;
+    size_t bandBytes;
+
+    static const size_t bandNodeBytes = sizeof(std::pair<const uint32_t, std::vector<int>>) + 2 * sizeof(void*);
+
+    static uint32_t band(const CaveSignature& signature, int i) {
+        return static_cast<uint32_t>(signature.bits[i >> 1] >> ((i & 1) * 32));
+    }
+
+public:
+
+    /**
+     * @brief Constructor for CaveDeduplicator
+     * @param similarityThreshold Caves at least this similar (0.0-1.0) count as duplicates
+     * @param maxSignatureDistance Signature bits two duplicates may differ in
+     */
+
+    explicit CaveDeduplicator(double similarityThreshold = 0.98, int maxSignatureDistance = 24)
+    : threshold(similarityThreshold), signatureRadius(maxSignatureDistance), bands(8), bandBytes(0) {}
+
+    /**
+     * @brief Offer a cave to the deduplicated set
+     * @param walls Wall grid of the cave
+     * @return true if the cave was new and has been kept
+     */
+
+    bool insert(const PackedGrid& walls) {
+        CaveSignature signature = CaveSignature::compute(walls);
+
+        std::vector<int> candidates;
+        for (int i = 0; i < 8; i++) {
+            auto it = bands[i].find(band(signature, i));
+            if (it == bands[i].end()) continue;
+            candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        for (int index : candidates) {
+            const PackedGrid& other = kept[index];
+            if (other.getWidth() != walls.getWidth() || other.getHeight() != walls.getHeight()) continue;
+            if (signatures[index].distance(signature) > signatureRadius) continue;
+            if (caveSimilarity(other, walls) >= threshold) return false;
+        }
+
+        int index = static_cast<int>(kept.size());
+        kept.push_back(walls);
+        signatures.push_back(signature);
+        for (int i = 0; i < 8; i++) {
+            std::vector<int>& list = bands[i][band(signature, i)];
+            size_t capacity = list.capacity();
+            if (list.empty()) bandBytes += bandNodeBytes;
+            list.push_back(index);
+            bandBytes += (list.capacity() - capacity) * sizeof(int);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Bytes held by the kept caves, their signatures and the band index
+     */
+
+    size_t getMemoryBytes() const {
+        size_t bytes = kept.capacity() * sizeof(PackedGrid) + signatures.capacity() * sizeof(CaveSignature) + bandBytes;
+        for (const PackedGrid& grid : kept) bytes += grid.getMemoryBytes();
+        for (const auto& index : bands) bytes += index.bucket_count() * sizeof(void*);
+        return bytes;
+    }
+
+    /**
+     * @brief Upper estimate of the index bytes one more kept cave adds,
+     *        on top of its grid, including allocator overhead
+     */
+
+    static size_t estimateIndexBytes() {
+        return 2 * sizeof(CaveSignature) + 8 * (bandNodeBytes + 2 * sizeof(void*) + 8 * sizeof(int));
+    }
+
+    size_t size() const { return kept.size(); }
+    const std::vector<PackedGrid>& getCaves() const { return kept; }
+};
+
+/**
+ * @struct Rgba
+ * @brief 8-bit RGBA colour in memory order
+ */
+
+struct Rgba {
+    uint8_t r, g, b, a;
+};
+
+/**
+ * @class CavePalette
+ * @brief Wall and open colours with a byte-to-pixels lookup table
+ *
+ * The table maps every byte of a packed row (8 cells) to its 8 RGBA
+ * pixels, so expanding a row is one 32-byte copy per byte of cells.
  */
 
-class CaveGenerator {
+class CavePalette {
 private:
-    int width, height;
-    std::vector<std::vector<bool>> cave;
-    double birthChance;
-    int birthLimit;
-    int deathLimit;
+    Rgba wall, open;
+    std::vector<uint32_t> lut;
+
+public:
 
     /**
-     * @brief Count alive neighbors around a cell
-     * @param x X coordinate of the cell
-     * @param y Y coordinate of the cell
-     * @return Number of alive neighbors (0-8)
+     * @brief Constructor for CavePalette
+     * @param wallColor Colour of alive cells
+     * @param openColor Colour of dead cells
      */
 
-    int countAliveNeighbors(int x, int y) {
-        int count = 0;
-        for (int i = -1; i <= 1; i++) {
-            for (int j = -1; j <= 1; j++) {
-                if (i == 0 && j == 0) continue;
+    CavePalette(Rgba wallColor = Rgba{255, 255, 255, 255}, Rgba openColor = Rgba{0, 0, 0, 255})
+    : wall(wallColor), open(openColor), lut(256 * 8) {
+        uint32_t wallPixel, openPixel;
+        std::memcpy(&wallPixel, &wall, 4);
+        std::memcpy(&openPixel, &open, 4);
+        for (int byte = 0; byte < 256; byte++) {
+            for (int bit = 0; bit < 8; bit++) {
+                lut[byte * 8 + bit] = (byte >> bit) & 1 ? wallPixel : openPixel;
+            }
+        }
+    }
 
-                int neighborX = x + i;
-                int neighborY = y + j;
+    Rgba getWall() const { return wall; }
+    Rgba getOpen() const { return open; }
 
-                if (neighborX >= 0 && neighborX < width && neighborY >= 0 && neighborY < height) {
-                    if (cave[neighborX][neighborY]) {
-                        count++;
-                    }
-                }
+    /**
+     * @brief 8 pixels for one byte of packed cells
+     */
+
+    const uint32_t* pixels(uint8_t byte) const { return &lut[byte * 8]; }
+};
+
+/**
+ * @brief Expand a packed grid to RGBA pixels
+ * @param grid Cells to draw; set bits use the wall colour
+ * @param palette Colours
+ * @param out Output of width * height * 4 bytes, row-major
+ * @param workers Worker threads (0 - all hardware threads)
+ */
+
+inline void expandToRGBA(const PackedGrid& grid, const CavePalette& palette, uint8_t* out, int workers = 0) {
+    int w = grid.getWidth();
+    parallelFor(0, grid.getHeight(), [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; y++) {
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(grid.row(y));
+            uint8_t* pixel = out + static_cast<size_t>(y) * w * 4;
+            int fullBytes = w / 8;
+            for (int i = 0; i < fullBytes; i++, pixel += 32) {
+                std::memcpy(pixel, palette.pixels(bytes[i]), 32);
+            }
+            if (w & 7) {
+                std::memcpy(pixel, palette.pixels(bytes[fullBytes]), (w & 7) * 4);
             }
         }
-        return count;
+    }, workers);
+}
+
+/**
+ * @brief Tint pixels by region label
+ * @param labels Row-major label per cell, negative for no label
+ * @param colors Colour lookup table; label i uses colors[i % colors.size()]
+ * @param alpha Blend weight of the tint (0-256)
+ * @param rgba Pixels to blend into, as produced by expandToRGBA()
+ */
+
+inline void overlayLabels(const std::vector<int>& labels, const std::vector<Rgba>& colors, int alpha, uint8_t* rgba) {
+    if (colors.empty()) return;
+    int keep = 256 - alpha;
+    for (size_t i = 0; i < labels.size(); i++) {
+        if (labels[i] < 0) continue;
+        const Rgba& c = colors[labels[i] % colors.size()];
+        uint8_t* pixel = rgba + i * 4;
+        pixel[0] = static_cast<uint8_t>((pixel[0] * keep + c.r * alpha) >> 8);
+        pixel[1] = static_cast<uint8_t>((pixel[1] * keep + c.g * alpha) >> 8);
+        pixel[2] = static_cast<uint8_t>((pixel[2] * keep + c.b * alpha) >> 8);
     }
+}
 
-public:
+/**
+ * @brief Brighten open cells by their distance from the nearest wall
+ * @param distances Row-major distances, see computeDistanceTransform()
+ * @param maxDistance Distance that gets full brightness
+ * @param rgba Pixels to shade, as produced by expandToRGBA()
+ */
+
+inline void shadeByDistance(const std::vector<int>& distances, int maxDistance, uint8_t* rgba) {
+    if (maxDistance <= 0) return;
+    std::vector<uint8_t> shade(maxDistance + 1);
+    for (int d = 0; d <= maxDistance; d++) {
+        shade[d] = static_cast<uint8_t>(40 + 160 * d / maxDistance);
+    }
+    for (size_t i = 0; i < distances.size(); i++) {
+        int d = distances[i];
+        if (d <= 0) continue;
+        uint8_t value = shade[std::min(d, maxDistance)];
+        uint8_t* pixel = rgba + i * 4;
+        pixel[0] = std::max(pixel[0], value);
+        pixel[1] = std::max(pixel[1], value);
+        pixel[2] = std::max(pixel[2], value);
+    }
+}
+
+/**
+ * @brief Tint cells by how often they flipped, blue (once) to red (15 or more)
+ * @param heatmap Flip counters, see FlipHeatmap
+ * @param rgba Pixels to blend into, as produced by expandToRGBA()
+ */
+
+inline void shadeByFlips(const FlipHeatmap& heatmap, uint8_t* rgba) {
+    Rgba colors[FlipHeatmap::maxCount + 1];
+    for (int n = 1; n <= FlipHeatmap::maxCount; n++) {
+        int heat = 255 * (n - 1) / (FlipHeatmap::maxCount - 1);
+        colors[n] = Rgba{static_cast<uint8_t>(heat), static_cast<uint8_t>(60), static_cast<uint8_t>(255 - heat), 255};
+    }
+    const int alpha = 200;
+    const int keep = 256 - alpha;
+    uint8_t* pixel = rgba;
+    for (int y = 0; y < heatmap.getHeight(); y++) {
+        for (int x = 0; x < heatmap.getWidth(); x++, pixel += 4) {
+            int n = heatmap.get(x, y);
+            if (n == 0) continue;
+            pixel[0] = static_cast<uint8_t>((pixel[0] * keep + colors[n].r * alpha) >> 8);
+            pixel[1] = static_cast<uint8_t>((pixel[1] * keep + colors[n].g * alpha) >> 8);
+            pixel[2] = static_cast<uint8_t>((pixel[2] * keep + colors[n].b * alpha) >> 8);
+        }
+    }
+}
+
+/**
+ * @brief Append a non-negative integer in decimal to a buffer
+ */
+
+inline void appendNumber(std::string& out, unsigned long long value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n) out.push_back(digits[--n]);
+}
+
+/**
+ * @brief Write a buffer to a file with one large write
+ * @return true on success
+ */
+
+inline bool writeFile(const std::string& path, const std::string& data) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Cannot open " << path << " for writing" << std::endl;
+        return false;
+    }
+    bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok) std::cerr << "Cannot write " << path << std::endl;
+    return ok;
+}
+
+/**
+ * @brief Base64 encoding (RFC 4648, with padding)
+ */
+
+inline void appendBase64(std::string& out, const unsigned char* data, size_t size) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    out.reserve(out.size() + (size + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 2 < size; i += 3) {
+        uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        out.push_back(alphabet[v >> 18]);
+        out.push_back(alphabet[(v >> 12) & 63]);
+        out.push_back(alphabet[(v >> 6) & 63]);
+        out.push_back(alphabet[v & 63]);
+    }
+    if (i < size) {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < size) v |= data[i + 1] << 8;
+        out.push_back(alphabet[v >> 18]);
+        out.push_back(alphabet[(v >> 12) & 63]);
+        out.push_back(i + 1 < size ? alphabet[(v >> 6) & 63] : '=');
+        out.push_back('=');
+    }
+}
+
+/**
+ * @brief Tiled layer data: little-endian 32-bit tile ids, zlib-compressed, base64
+ * @param walls Alive cells
+ * @param wallTile Tile id of walls
+ * @param openTile Tile id of open cells
+ * @param out Buffer to append the encoded layer to
+ * @return false if compression failed
+ */
+
+inline bool appendTiledLayer(const PackedGrid& walls, uint32_t wallTile, uint32_t openTile, std::string& out) {
+    int w = walls.getWidth();
+    int h = walls.getHeight();
+    std::vector<unsigned char> raw(static_cast<size_t>(w) * h * 4);
+    unsigned char wallBytes[4] = {
+        static_cast<unsigned char>(wallTile), static_cast<unsigned char>(wallTile >> 8),
+        static_cast<unsigned char>(wallTile >> 16), static_cast<unsigned char>(wallTile >> 24)
+    };
+    unsigned char openBytes[4] = {
+        static_cast<unsigned char>(openTile), static_cast<unsigned char>(openTile >> 8),
+        static_cast<unsigned char>(openTile >> 16), static_cast<unsigned char>(openTile >> 24)
+    };
+    unsigned char* p = raw.data();
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++, p += 4) {
+            std::memcpy(p, walls.get(x, y) ? wallBytes : openBytes, 4);
+        }
+    }
+
+    uLongf packedSize = compressBound(static_cast<uLong>(raw.size()));
+    std::vector<unsigned char> packed(packedSize);
+    if (compress2(packed.data(), &packedSize, raw.data(), static_cast<uLong>(raw.size()), Z_BEST_SPEED) != Z_OK) {
+        std::cerr << "zlib compression failed" << std::endl;
+        return false;
+    }
+    appendBase64(out, packed.data(), packedSize);
+    return true;
+}
+
+/**
+ * @brief Export a cave as CSV of tile ids, one row of cells per line
+ * @param walls Alive cells
+ * @param path Output file
+ * @param wallTile Tile id of walls
+ * @param openTile Tile id of open cells
+ * @return true on success
+ */
+
+inline bool exportCsv(const PackedGrid& walls, const std::string& path, uint32_t wallTile = 1, uint32_t openTile = 2) {
+    std::string wallText, openText;
+    appendNumber(wallText, wallTile);
+    appendNumber(openText, openTile);
+
+    int w = walls.getWidth();
+    int h = walls.getHeight();
+    std::string out;
+    out.reserve(static_cast<size_t>(w) * h * (std::max(wallText.size(), openText.size()) + 1));
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            out += walls.get(x, y) ? wallText : openText;
+            out.push_back(x + 1 < w ? ',' : '\n');
+        }
+    }
+    return writeFile(path, out);
+}
+
+/**
+ * @brief Export a cave as a Tiled TMX map with a base64+zlib layer
+ * @param walls Alive cells
+ * @param path Output file
+ * @param tileSize Tile width and height in pixels
+ * @return true on success
+ *
+ * The map refers to a two-tile tileset image "cave_tiles.png"
+ * (tile 1 - wall, tile 2 - floor).
+ */
+
+inline bool exportTmx(const PackedGrid& walls, const std::string& path, int tileSize = 16) {
+    std::string out;
+    out += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<map version=\"1.10\" orientation=\"orthogonal\" "
+           "renderorder=\"right-down\" width=\"";
+    appendNumber(out, walls.getWidth());
+    out += "\" height=\"";
+    appendNumber(out, walls.getHeight());
+    out += "\" tilewidth=\"";
+    appendNumber(out, tileSize);
+    out += "\" tileheight=\"";
+    appendNumber(out, tileSize);
+    out += "\" infinite=\"0\">\n <tileset firstgid=\"1\" name=\"cave\" tilewidth=\"";
+    appendNumber(out, tileSize);
+    out += "\" tileheight=\"";
+    appendNumber(out, tileSize);
+    out += "\" tilecount=\"2\" columns=\"2\">\n  <image source=\"cave_tiles.png\" width=\"";
+    appendNumber(out, tileSize * 2);
+    out += "\" height=\"";
+    appendNumber(out, tileSize);
+    out += "\"/>\n </tileset>\n <layer id=\"1\" name=\"cave\" width=\"";
+    appendNumber(out, walls.getWidth());
+    out += "\" height=\"";
+    appendNumber(out, walls.getHeight());
+    out += "\">\n  <data encoding=\"base64\" compression=\"zlib\">";
+    if (!appendTiledLayer(walls, 1, 2, out)) return false;
+    out += "</data>\n </layer>\n</map>\n";
+    return writeFile(path, out);
+}
+
+/**
+ * @brief Export a cave as a Tiled JSON map with a base64+zlib layer
+ * @param walls Alive cells
+ * @param path Output file
+ * @param tileSize Tile width and height in pixels
+ * @return true on success
+ *
+ * Uses the same tileset as exportTmx().
+ */
+
+inline bool exportTiledJson(const PackedGrid& walls, const std::string& path, int tileSize = 16) {
+    std::string out;
+    out += "{\"type\":\"map\",\"version\":\"1.10\",\"orientation\":\"orthogonal\",\"renderorder\":\"right-down\","
+           "\"infinite\":false,\"width\":";
+    appendNumber(out, walls.getWidth());
+    out += ",\"height\":";
+    appendNumber(out, walls.getHeight());
+    out += ",\"tilewidth\":";
+    appendNumber(out, tileSize);
+    out += ",\"tileheight\":";
+    appendNumber(out, tileSize);
+    out += ",\"nextlayerid\":2,\"nextobjectid\":1,\"tilesets\":[{\"firstgid\":1,\"name\":\"cave\","
+           "\"image\":\"cave_tiles.png\",\"imagewidth\":";
+    appendNumber(out, tileSize * 2);
+    out += ",\"imageheight\":";
+    appendNumber(out, tileSize);
+    out += ",\"tilewidth\":";
+    appendNumber(out, tileSize);
+    out += ",\"tileheight\":";
+    appendNumber(out, tileSize);
+    out += ",\"tilecount\":2,\"columns\":2,\"margin\":0,\"spacing\":0}],\"layers\":[{\"id\":1,\"name\":\"cave\","
+           "\"type\":\"tilelayer\",\"x\":0,\"y\":0,\"opacity\":1,\"visible\":true,\"width\":";
+    appendNumber(out, walls.getWidth());
+    out += ",\"height\":";
+    appendNumber(out, walls.getHeight());
+    out += ",\"encoding\":\"base64\",\"compression\":\"zlib\",\"data\":\"";
+    if (!appendTiledLayer(walls, 1, 2, out)) return false;
+    out += "\"}]}\n";
+    return writeFile(path, out);
+}
+
+/**
+ * @brief Header of a checkpoint file, followed by the zlib-compressed
+ *        packed grid (wordsPerRow * height little-endian uint64 words)
+ */
+
+struct CheckpointHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int64_t generation;
+    uint32_t seed;
+    int32_t birthLimit;
+    int32_t deathLimit;
+    uint32_t reserved;
+    double birthChance;
+    uint64_t compressedSize;
+};
+
+const uint32_t checkpointMagic = 0x4B564143; // "CAVK"
+const uint32_t checkpointVersion = 2;
+const long long checkpointMaxCells = 1LL << 32;
+
+/**
+ * @class CheckpointWriter
+ * @brief Writes compressed snapshots of a long run on a background thread
+ *
+ * submit() packs the cave on the caller's thread and hands the grid over
+ * by swapping buffers, so the simulation never waits for compression or
+ * disk. If the writer is still busy when the next snapshot arrives, the
+ * older pending snapshot is replaced. Files are written to "<path>.tmp",
+ * synced and renamed over the path, so a crash leaves the last complete
+ * checkpoint in place.
+ */
+
+class CheckpointWriter {
+private:
+    std::string path;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    PackedGrid pending;
+    CheckpointHeader pendingHeader;
+    bool hasPending;
+    bool busy;
+    bool stopping;
+    long long written;
+    std::thread worker;
+
+    CheckpointWriter(const CheckpointWriter&);
+    CheckpointWriter& operator=(const CheckpointWriter&);
+
+    void loop() {
+        PackedGrid grid;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return hasPending || stopping; });
+            if (!hasPending) break;
+            std::swap(grid, pending);
+            CheckpointHeader header = pendingHeader;
+            hasPending = false;
+            busy = true;
+            lock.unlock();
+
+            bool ok = write(grid, header);
+
+            lock.lock();
+            busy = false;
+            if (ok) written++;
+            idle.notify_all();
+        }
+    }
+
+    bool write(const PackedGrid& grid, CheckpointHeader header) const {
+        const unsigned char* raw = reinterpret_cast<const unsigned char*>(grid.row(0));
+        uLong rawSize = static_cast<uLong>(static_cast<size_t>(grid.getWordsPerRow()) * grid.getHeight() * sizeof(uint64_t));
+        uLongf packedSize = compressBound(rawSize);
+        std::vector<unsigned char> packed(packedSize);
+        if (compress2(packed.data(), &packedSize, raw, rawSize, Z_BEST_SPEED) != Z_OK) {
+            std::cerr << "Checkpoint compression failed" << std::endl;
+            return false;
+        }
+
+        header.compressedSize = packedSize;
+
+        std::string temporary = path + ".tmp";
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (!file) {
+            std::cerr << "Cannot open " << temporary << " for writing" << std::endl;
+            return false;
+        }
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  std::fwrite(packed.data(), 1, packedSize, file) == packedSize &&
+                  std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::cerr << "Cannot write checkpoint " << path << std::endl;
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
 
+public:
     /**
-     * @brief Constructor for CaveGenerator
-     * @param w Width of the cave
-     * @param h Height of the cave
-     * @param chance Birth chance probability (0.0-1.0)
-     * @param birth Birth limit for new cells
-     * @param death Death limit for existing cells
+     * @brief Start the writer thread
+     * @param file Checkpoint file, replaced on every write
      */
 
-    CaveGenerator(int w, int h, double chance, int birth, int death)
-    : width(w), height(h), birthChance(chance), birthLimit(birth), deathLimit(death) {
-        cave.resize(width, std::vector<bool>(height, false));
-        initializeCave();
+    explicit CheckpointWriter(const std::string& file)
+    : path(file), pendingHeader(), hasPending(false), busy(false), stopping(false), written(0) {
+        worker = std::thread(&CheckpointWriter::loop, this);
     }
 
     /**
-     * @brief Initialize cave with random cells based on birth chance
+     * @brief Write the last submitted snapshot and stop the thread
      */
 
-    void initializeCave() {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_real_distribution<> dis(0.0, 1.0);
+    ~CheckpointWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
 
-        for (int x = 0; x < width; x++) {
-            for (int y = 0; y < height; y++) {
-                cave[x][y] = (dis(gen) < birthChance);
-            }
+    /**
+     * @brief Queue a snapshot of the cave with its iteration, seed and rules
+     * @param generator Generator to snapshot
+     */
+
+    void submit(const CaveGenerator& generator) {
+        PackedGrid snapshot = PackedGrid::fromCave(generator.getCave(), true);
+        CheckpointHeader header = CheckpointHeader();
+        header.magic = checkpointMagic;
+        header.version = checkpointVersion;
+        header.width = generator.getWidth();
+        header.height = generator.getHeight();
+        header.generation = generator.getGeneration();
+        header.seed = generator.getSeed();
+        header.birthLimit = generator.getBirthLimit();
+        header.deathLimit = generator.getDeathLimit();
+        header.birthChance = generator.getBirthChance();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::swap(pending, snapshot);
+            pendingHeader = header;
+            hasPending = true;
         }
+        wake.notify_one();
     }
 
     /**
-     * @brief Perform one iteration of cellular automata
-     *
-     * Applies the rules:
-     * - Alive cells die if neighbors < deathLimit
-     * - Dead cells become alive if neighbors > birthLimit
+     * @brief Block until every submitted snapshot is on disk
      */
 
-    void simulateStep() {
-        std::vector<std::vector<bool>> newCave = cave;
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return !hasPending && !busy; });
+    }
 
-        for (int x = 0; x < width; x++) {
-            for (int y = 0; y < height; y++) {
-                int aliveNeighbors = countAliveNeighbors(x, y);
+    /**
+     * @brief Number of checkpoints written successfully
+     */
 
-                if (cave[x][y]) {
-                    if (aliveNeighbors < deathLimit) {
-                        newCave[x][y] = false;
-                    }
-                } else {
-                    if (aliveNeighbors > birthLimit) {
-                        newCave[x][y] = true;
-                    }
+    long long getWritten() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return written;
+    }
+};
+
+/**
+ * @brief Read a checkpoint written by CheckpointWriter
+ * @param path Checkpoint file
+ * @param walls Restored alive cells
+ * @param header Iteration, seed and rules of the snapshot
+ * @return false if the file is missing or damaged
+ *
+ * Sizes in the header are checked against the file size and
+ * checkpointMaxCells before anything is allocated.
+ */
+
+inline bool loadCheckpoint(const std::string& path, PackedGrid& walls, CheckpointHeader& header) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    struct stat info;
+    bool ok = fstat(fileno(file), &info) == 0 && static_cast<uint64_t>(info.st_size) >= sizeof(header) &&
+              std::fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == checkpointMagic && header.version == checkpointVersion;
+    uint64_t rawBytes = 0;
+    if (ok) {
+        long long cells = static_cast<long long>(header.width) * header.height;
+        rawBytes = static_cast<uint64_t>((header.width + 63LL) / 64) * header.height * sizeof(uint64_t);
+        // zlib cannot compress better than about 1032:1
+        ok = header.width > 0 && header.height > 0 && cells <= checkpointMaxCells &&
+             header.compressedSize == static_cast<uint64_t>(info.st_size) - sizeof(header) &&
+             rawBytes <= header.compressedSize * 1032 + 64;
+    }
+    std::vector<unsigned char> packed;
+    if (ok) {
+        packed.resize(static_cast<size_t>(header.compressedSize));
+        ok = std::fread(packed.data(), 1, packed.size(), file) == packed.size();
+    }
+    std::fclose(file);
+
+    if (ok) {
+        PackedGrid grid(header.width, header.height);
+        uLongf rawSize = static_cast<uLongf>(rawBytes);
+        ok = uncompress(reinterpret_cast<unsigned char*>(grid.row(0)), &rawSize, packed.data(),
+                        static_cast<uLong>(packed.size())) == Z_OK && rawSize == rawBytes;
+        if (ok) walls = std::move(grid);
+    }
+    if (!ok) std::cerr << "Checkpoint " << path << " is damaged or from another version" << std::endl;
+    return ok;
+}
+
+/**
+ * @brief Per-host file caching autoTuneStep() results
+ *
+ * "$XDG_CACHE_HOME/cave_generator/tune-<host>.txt", falling back to
+ * "~/.cache"; empty if neither variable is set.
+ */
+
+inline std::string stepTuneCachePath() {
+    std::string base;
+    const char* cache = std::getenv("XDG_CACHE_HOME");
+    const char* home = std::getenv("HOME");
+    if (cache && *cache) {
+        base = cache;
+    } else if (home && *home) {
+        base = std::string(home) + "/.cache";
+    } else {
+        return std::string();
+    }
+
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    return base + "/cave_generator/step-" + host + ".txt";
+}
+
+/**
+ * @brief Size class of a cave dimension for the autoTuneStep() cache
+ * @param size Width or height in cells
+ * @return Number of bits needed for size - 1, i.e. ceil(log2(size))
+ */
+
+inline int stepTuneSizeClass(int size) {
+    int bits = 0;
+    for (unsigned rest = static_cast<unsigned>(std::max(size, 1) - 1); rest; rest >>= 1) bits++;
+    return bits;
+}
+
+/**
+ * @brief Pick the fastest StepConfig for a cave size on this machine
+ * @param width Width of the cave
+ * @param height Height of the cave
+ * @param useCache Read and update the per-host cache file
+ * @return Tuned configuration
+ *
+ * Times a few steps of each candidate on a random proxy cave of at most
+ * stepTuneRows x stepTuneColumns cells: first the kernel on one thread,
+ * then the thread count, then the band width. Remaining candidates are
+ * skipped once stepTuneSeconds have passed. Results are shared by all sizes
+ * of the same stepTuneSizeClass(); each line of the cache file is
+ * "widthClass heightClass kernel workers band".
+ */
+
+const int stepTuneRows = 1024;
+const int stepTuneColumns = 16384;
+const double stepTuneSeconds = 2.0;
+
+inline StepConfig autoTuneStep(int width, int height, bool useCache = true) {
+    int widthClass = stepTuneSizeClass(width);
+    int heightClass = stepTuneSizeClass(height);
+    std::string path = useCache ? stepTuneCachePath() : std::string();
+    if (!path.empty()) {
+        FILE* file = std::fopen(path.c_str(), "r");
+        if (file) {
+            int w, h, kernel, workers, band;
+            while (std::fscanf(file, "%d %d %d %d %d", &w, &h, &kernel, &workers, &band) == 5) {
+                if (w == widthClass && h == heightClass) {
+                    std::fclose(file);
+                    StepConfig cached;
+                    cached.kernel = kernel == 1 ? StepKernel::Columns : StepKernel::Cells;
+                    cached.workers = std::max(workers, 1);
+                    cached.bandColumns = std::max(band, 1);
+                    return cached;
                 }
             }
+            std::fclose(file);
         }
-
-        cave = newCave;
     }
 
-    const std::vector<std::vector<bool>>& getCave() const {
-        return cave;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(stepTuneSeconds);
+    CaveGenerator bench(std::min(width, stepTuneColumns), std::min(height, stepTuneRows), 0.45, 4, 3);
+    bench.initializeCave(1u);
+    auto measure = [&bench, deadline](const StepConfig& config) {
+        if (std::chrono::steady_clock::now() > deadline) return 1e30;
+        bench.setStepConfig(config);
+        bench.resetToInitial();
+        double best = 1e30;
+        for (int i = 0; i < 3; i++) {
+            auto start = std::chrono::steady_clock::now();
+            bench.simulateStep();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    };
+
+    StepConfig best;
+    double bestTime = measure(best);
+
+    StepConfig candidate = best;
+    candidate.kernel = StepKernel::Columns;
+    double time = measure(candidate);
+    if (time < bestTime) {
+        best = candidate;
+        bestTime = time;
     }
 
-    int getWidth() const { return width; }
-    int getHeight() const { return height; }
-    double getBirthChance() const { return birthChance; }
-    int getBirthLimit() const { return birthLimit; }
-    int getDeathLimit() const { return deathLimit; }
+    int hardware = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    for (int workers = 2; workers <= hardware; workers *= 2) {
+        candidate = best;
+        candidate.workers = workers;
+        time = measure(candidate);
+        if (time < bestTime) {
+            best = candidate;
+            bestTime = time;
+        }
+    }
+    if (hardware > 2 && (hardware & (hardware - 1)) != 0) {
+        candidate = best;
+        candidate.workers = hardware;
+        time = measure(candidate);
+        if (time < bestTime) {
+            best = candidate;
+            bestTime = time;
+        }
+    }
 
-    int getAliveCount() const {
-        int count = 0;
-        for (int x = 0; x < width; x++) {
-            for (int y = 0; y < height; y++) {
-                if (cave[x][y]) count++;
+    if (best.workers > 1) {
+        StepConfig bands = best;
+        for (int band = 64; band <= 256; band *= 2) {
+            candidate = bands;
+            candidate.bandColumns = band;
+            time = measure(candidate);
+            if (time < bestTime) {
+                best = candidate;
+                bestTime = time;
             }
         }
-        return count;
     }
-};
+
+    if (!path.empty()) {
+        std::string directory = path.substr(0, path.rfind('/'));
+        mkdir(directory.substr(0, directory.rfind('/')).c_str(), 0755);
+        mkdir(directory.c_str(), 0755);
+        FILE* file = std::fopen(path.c_str(), "a");
+        if (file) {
+            std::fprintf(file, "%d %d %d %d %d\n", widthClass, heightClass, best.kernel == StepKernel::Columns ? 1 : 0,
+                         best.workers, best.bandColumns);
+            std::fclose(file);
+        }
+    }
+    return best;
+}
+
+#ifndef CAVE_LIBRARY
 
 /**
  * @class GraphicsManager
@@ -154,24 +3770,59 @@ private:
     int iteration;
     int cellSize;
     CaveGenerator& caveGen;
+    bool compareMode;
+    bool comparisonDirty;
+    int variantIteration;
+    std::vector<CaveGenerator> variants;
+    std::vector<sf::Texture> variantTextures;
+    CavePalette palette;
+    sf::Texture caveTexture;
+    std::vector<sf::Uint8> cavePixels;
+    bool caveDirty;
+    int overlay;
+    bool playing;
+    SharedCaveReader* source;
+    PackedGrid sourceGrid;
+    long long sourceGeneration;
 
 public:
 
     /**
      * @brief Constructor for GraphicsManager
      * @param generator Reference to the CaveGenerator instance
+     * @param sharedSource Segment of an external generator to mirror into
+     *        generator every frame (viewer mode), or nullptr
+     *
+     * In viewer mode the window only watches: keys that would step or
+     * change the cave are ignored.
      */
 
-    GraphicsManager(CaveGenerator& generator)
+    GraphicsManager(CaveGenerator& generator, SharedCaveReader* sharedSource = nullptr)
     : window(),
     font(),
     fontLoaded(false),
     infoText(),
     iteration(0),
     cellSize(0),
-    caveGen(generator) {
+    caveGen(generator),
+    compareMode(false),
+    comparisonDirty(true),
+    variantIteration(0),
+    variants(),
+    variantTextures(),
+    palette(),
+    caveTexture(),
+    cavePixels(),
+    caveDirty(true),
+    overlay(0),
+    playing(false),
+    source(sharedSource),
+    sourceGrid(),
+    sourceGeneration(-1) {
 
         window.create(sf::VideoMode(1000, 700), "Cave Generator");
+        caveGen.setStepStats(true);
+        caveGen.setFlipTracking(true);
 
         // Try to load font
         const char* fontPaths[] = {
@@ -216,11 +3867,31 @@ public:
     void run() {
         while (window.isOpen()) {
             handleEvents();
+            if (source) {
+                syncFromSource();
+            } else if (playing) {
+                caveGen.simulateStep();
+                iteration++;
+            }
             render();
         }
     }
 
-private:
+private:
+    /**
+     * @brief Mirror the latest published generation, if it is new
+     */
+
+    void syncFromSource() {
+        if (static_cast<long long>(source->getGeneration()) == sourceGeneration) return;
+        uint64_t generation = 0;
+        if (source->read(sourceGrid, generation)) {
+            sourceGeneration = static_cast<long long>(generation);
+            caveGen.loadCave(sourceGrid, sourceGeneration);
+            iteration = static_cast<int>(generation);
+        }
+    }
+
     void handleEvents() {
         sf::Event event;
         while (window.pollEvent(event)) {
@@ -228,6 +3899,11 @@ private:
                 window.close();
             }
 
+            if (source && event.type == sf::Event::KeyPressed &&
+                event.key.code != sf::Keyboard::O && event.key.code != sf::Keyboard::Escape) {
+                continue;
+            }
+
             if (event.type == sf::Event::KeyPressed) {
                 if (event.key.code == sf::Keyboard::Space) {
                     caveGen.simulateStep();
@@ -236,18 +3912,201 @@ private:
                     // Restart with new cave
                     caveGen.initializeCave();
                     iteration = 0;
+                    comparisonDirty = true;
+                } else if (event.key.code == sf::Keyboard::Up) {
+                    caveGen.setBirthLimit(std::min(caveGen.getBirthLimit() + 1, 8));
+                    rerun();
+                    comparisonDirty = true;
+                } else if (event.key.code == sf::Keyboard::Down) {
+                    caveGen.setBirthLimit(std::max(caveGen.getBirthLimit() - 1, 0));
+                    rerun();
+                    comparisonDirty = true;
+                } else if (event.key.code == sf::Keyboard::Right) {
+                    caveGen.setDeathLimit(std::min(caveGen.getDeathLimit() + 1, 8));
+                    rerun();
+                    comparisonDirty = true;
+                } else if (event.key.code == sf::Keyboard::Left) {
+                    caveGen.setDeathLimit(std::max(caveGen.getDeathLimit() - 1, 0));
+                    rerun();
+                    comparisonDirty = true;
+                } else if (event.key.code == sf::Keyboard::Equal) {
+                    changeBirthChance(0.01);
+                } else if (event.key.code == sf::Keyboard::Hyphen) {
+                    changeBirthChance(-0.01);
+                } else if (event.key.code == sf::Keyboard::RBracket) {
+                    iteration++;
+                    rerun();
+                } else if (event.key.code == sf::Keyboard::LBracket) {
+                    iteration = std::max(iteration - 1, 0);
+                    rerun();
+                } else if (event.key.code == sf::Keyboard::C) {
+                    compareMode = !compareMode;
+                } else if (event.key.code == sf::Keyboard::O) {
+                    overlay = (overlay + 1) % 4;
+                    caveDirty = true;
+                } else if (event.key.code == sf::Keyboard::P) {
+                    playing = !playing;
                 } else if (event.key.code == sf::Keyboard::Escape) {
                     window.close();
                 }
             }
+
+            if (event.type == sf::Event::MouseWheelScrolled && !source) {
+                iteration = std::max(iteration + static_cast<int>(event.mouseWheelScroll.delta), 0);
+                rerun();
+            }
+        }
+    }
+
+    /**
+     * @brief Bring the comparison grid up to date with the current cave
+     *
+     * Builds a 3 x 3 grid of birth limit (rows) and death limit (columns)
+     * offsets of -1, 0 and +1. Every variant starts from the same cached
+     * noise and runs on its own thread; the results are then uploaded as
+     * textures. The grid is rebuilt only after the noise, limits or birth
+     * chance change or the iteration count goes back; when it only moves
+     * forward, the variants just take the missing steps.
+     */
+
+    void updateComparison() {
+        const int side = 3;
+        bool rebuild = comparisonDirty || variants.empty() || iteration < variantIteration;
+        if (!rebuild && iteration == variantIteration) return;
+
+        if (rebuild) {
+            variants.assign(side * side, caveGen);
+            variantTextures.resize(side * side);
+            variantIteration = 0;
+
+            for (int row = 0; row < side; row++) {
+                for (int col = 0; col < side; col++) {
+                    CaveGenerator& variant = variants[row * side + col];
+                    variant.setBirthLimit(std::min(std::max(caveGen.getBirthLimit() + row - 1, 0), 8));
+                    variant.setDeathLimit(std::min(std::max(caveGen.getDeathLimit() + col - 1, 0), 8));
+                    variant.disableSharedMemory();
+                    variant.setStepConfig(StepConfig());
+                    variant.setStepStats(false);
+                    variant.setFlipTracking(false);
+                    variant.resetToInitial();
+                }
+            }
+        }
+
+        std::vector<std::thread> workers;
+        for (CaveGenerator& variant : variants) {
+            CaveGenerator* target = &variant;
+            int steps = iteration - variantIteration;
+            workers.push_back(std::thread([target, steps]() {
+                for (int i = 0; i < steps; i++) {
+                    target->simulateStep();
+                }
+            }));
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        int w = caveGen.getWidth();
+        int h = caveGen.getHeight();
+        std::vector<sf::Uint8> pixels(static_cast<size_t>(w) * h * 4);
+        for (size_t i = 0; i < variants.size(); i++) {
+            expandToRGBA(PackedGrid::fromCave(variants[i].getCave(), true), palette, pixels.data());
+            if (variantTextures[i].getSize().x != static_cast<unsigned>(w) ||
+                variantTextures[i].getSize().y != static_cast<unsigned>(h)) {
+                variantTextures[i].create(w, h);
+            }
+            variantTextures[i].update(pixels.data());
+        }
+
+        variantIteration = iteration;
+        comparisonDirty = false;
+    }
+
+    void drawComparison() {
+        const int side = 3;
+        const float areaWidth = 600.0f;
+        const float areaHeight = 640.0f;
+        const float gap = 10.0f;
+        int startX = 20;
+        int startY = 20;
+
+        updateComparison();
+
+        float cellWidth = (areaWidth - gap * (side - 1)) / side;
+        float cellHeight = (areaHeight - gap * (side - 1)) / side;
+        float scale = std::min(cellWidth / caveGen.getWidth(), cellHeight / caveGen.getHeight());
+
+        for (int row = 0; row < side; row++) {
+            for (int col = 0; col < side; col++) {
+                int index = row * side + col;
+                float x = startX + col * (cellWidth + gap);
+                float y = startY + row * (cellHeight + gap);
+
+                sf::Sprite sprite(variantTextures[index]);
+                sprite.setPosition(x, y);
+                sprite.setScale(scale, scale);
+                window.draw(sprite);
+
+                if (index == side * side / 2) {
+                    sf::RectangleShape frame(sf::Vector2f(caveGen.getWidth() * scale, caveGen.getHeight() * scale));
+                    frame.setPosition(x, y);
+                    frame.setFillColor(sf::Color::Transparent);
+                    frame.setOutlineColor(sf::Color::Yellow);
+                    frame.setOutlineThickness(2);
+                    window.draw(frame);
+                }
+
+                if (fontLoaded) {
+                    sf::Text label;
+                    label.setFont(font);
+                    label.setString("B" + std::to_string(variants[index].getBirthLimit()) +
+                                    " D" + std::to_string(variants[index].getDeathLimit()));
+                    label.setCharacterSize(12);
+                    label.setFillColor(sf::Color::Yellow);
+                    label.setPosition(x + 2, y + 2);
+                    window.draw(label);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Replay the current number of iterations from the cached starting cave
+     */
+
+    void rerun() {
+        caveGen.resetToInitial();
+        for (int i = 0; i < iteration; i++) {
+            caveGen.simulateStep();
         }
     }
 
+    /**
+     * @brief Change the birth chance and redraw the noise from the same seed
+     * @param delta Amount to add to the birth chance
+     *
+     * The seed is kept, so the same random field is only thresholded
+     * differently and the cave changes smoothly.
+     */
+
+    void changeBirthChance(double delta) {
+        double chance = std::min(std::max(caveGen.getBirthChance() + delta, 0.0), 1.0);
+        caveGen.setBirthChance(chance);
+        caveGen.initializeCave(caveGen.getSeed());
+        rerun();
+        comparisonDirty = true;
+    }
+
     void render() {
         window.clear(sf::Color(20, 20, 20));
 
-        // Draw cave (left side)
-        drawCave();
+        // Draw cave or the comparison grid (left side)
+        if (compareMode) {
+            drawComparison();
+        } else {
+            drawCave();
+        }
 
         // Draw info panel (right side)
         drawInfoPanel();
@@ -256,7 +4115,6 @@ private:
     }
 
     void drawCave() {
-        const auto& cave = caveGen.getCave();
         int caveWidth = caveGen.getWidth();
         int caveHeight = caveGen.getHeight();
 
@@ -283,21 +4141,82 @@ private:
             window.draw(caveTitle);
         }
 
-        // Cave cells
-        for (int x = 0; x < caveWidth; x++) {
-            for (int y = 0; y < caveHeight; y++) {
-                sf::RectangleShape cell(sf::Vector2f(cellSize - 1, cellSize - 1));
-                cell.setPosition(startX + x * cellSize, startY + y * cellSize);
+        // Cave cells: overlays depend on the whole cave, plain cells only on what changed
+        std::vector<CaveRect> changed = caveGen.getDirtyRects();
+        if (caveDirty || (overlay != 0 && !changed.empty())) {
+            updateCaveTexture();
+        } else if (!changed.empty()) {
+            updateDirtyRegions(changed);
+        }
+        sf::Sprite sprite(caveTexture);
+        sprite.setPosition(startX, startY);
+        sprite.setScale(cellSize, cellSize);
+        window.draw(sprite);
+    }
 
-                if (cave[x][y]) {
-                    cell.setFillColor(sf::Color::White);
-                } else {
-                    cell.setFillColor(sf::Color::Black);
-                }
+    /**
+     * @brief Expand the cave to pixels and upload it to the cave texture
+     *
+     * Overlay 1 tints rooms (see detectRooms), overlay 2 shades open cells
+     * by their distance from the walls, overlay 3 shows how often cells
+     * flipped since the cave was drawn.
+     */
+
+    void updateCaveTexture() {
+        int w = caveGen.getWidth();
+        int h = caveGen.getHeight();
+        PackedGrid walls = PackedGrid::fromCave(caveGen.getCave(), true);
 
-                window.draw(cell);
+        cavePixels.resize(static_cast<size_t>(w) * h * 4);
+        expandToRGBA(walls, palette, cavePixels.data());
+
+        if (overlay == 1) {
+            static const std::vector<Rgba> roomColors = {
+                {230, 80, 80, 255}, {80, 200, 90, 255}, {80, 120, 230, 255}, {230, 200, 70, 255},
+                {190, 90, 220, 255}, {70, 200, 210, 255}, {240, 140, 60, 255}, {150, 150, 150, 255}
+            };
+            RoomGraph rooms = detectRooms(complementGrid(walls));
+            overlayLabels(rooms.labels, roomColors, 160, cavePixels.data());
+        } else if (overlay == 2) {
+            std::vector<int> distances = computeDistanceTransform(complementGrid(walls));
+            int maxDistance = 0;
+            for (int d : distances) maxDistance = std::max(maxDistance, d);
+            shadeByDistance(distances, maxDistance, cavePixels.data());
+        } else if (overlay == 3) {
+            shadeByFlips(caveGen.getFlipHeatmap(), cavePixels.data());
+        }
+
+        if (caveTexture.getSize().x != static_cast<unsigned>(w) ||
+            caveTexture.getSize().y != static_cast<unsigned>(h)) {
+            caveTexture.create(w, h);
+        }
+        caveTexture.update(cavePixels.data());
+        caveGen.clearDirty();
+        caveDirty = false;
+    }
+
+    /**
+     * @brief Upload only the tiles the generator reports as changed
+     * @param changed Dirty rectangles, see CaveGenerator::getDirtyRects()
+     */
+
+    void updateDirtyRegions(const std::vector<CaveRect>& changed) {
+        const auto& cave = caveGen.getCave();
+        Rgba wall = palette.getWall();
+        Rgba open = palette.getOpen();
+
+        for (const CaveRect& rect : changed) {
+            cavePixels.resize(static_cast<size_t>(rect.w) * rect.h * 4);
+            for (int x = 0; x < rect.w; x++) {
+                const std::vector<bool>& column = cave[rect.x + x];
+                for (int y = 0; y < rect.h; y++) {
+                    const Rgba& color = column[rect.y + y] ? wall : open;
+                    std::memcpy(&cavePixels[(static_cast<size_t>(y) * rect.w + x) * 4], &color, 4);
+                }
             }
+            caveTexture.update(cavePixels.data(), rect.w, rect.h, rect.x, rect.y);
         }
+        caveGen.clearDirty();
     }
 
     void drawInfoPanel() {
@@ -305,7 +4224,7 @@ private:
         int panelY = 20;
 
         // Info panel background
-        sf::RectangleShape panel(sf::Vector2f(320, 450));
+        sf::RectangleShape panel(sf::Vector2f(320, 520));
         panel.setPosition(panelX - 10, panelY - 10);
         panel.setFillColor(sf::Color(40, 40, 40));
         panel.setOutlineColor(sf::Color::White);
@@ -322,18 +4241,34 @@ private:
             title.setPosition(panelX, panelY);
             window.draw(title);
 
-            // Information
+            // Information; a mirrored cave has no rules or steps of its own
             std::string info =
+            (source ? "Viewing: " + source->getName() + "\n" : std::string()) +
             "Iteration: " + std::to_string(iteration) + "\n\n" +
             "Size: " + std::to_string(caveGen.getWidth()) + " x " +
             std::to_string(caveGen.getHeight()) + "\n" +
-            "Alive cells: " + std::to_string(caveGen.getAliveCount()) + "\n" +
-            "Birth chance: " + std::to_string(static_cast<int>(caveGen.getBirthChance() * 100)) + "%\n" +
-            "Birth limit: " + std::to_string(caveGen.getBirthLimit()) + "\n" +
-            "Death limit: " + std::to_string(caveGen.getDeathLimit()) + "\n\n" +
-            "CONTROLS:\n" +
-            "SPACE - Next iteration\n" +
-            "R - New random cave\n" +
+            "Alive cells: " + std::to_string(caveGen.getAliveCount()) + "\n";
+            if (!source) {
+                info +=
+                "Birth chance: " + std::to_string(static_cast<int>(caveGen.getBirthChance() * 100 + 0.5)) + "%\n" +
+                "Birth limit: " + std::to_string(caveGen.getBirthLimit()) + "\n" +
+                "Death limit: " + std::to_string(caveGen.getDeathLimit()) + "\n" +
+                describeStepStats();
+            }
+            info += "\nCONTROLS:\n";
+            if (!source) {
+                info +=
+                "SPACE - Next iteration\n"
+                "R - New random cave\n"
+                "UP/DOWN - Birth limit\n"
+                "LEFT/RIGHT - Death limit\n"
+                "+/- - Birth chance\n"
+                "[ ] / Wheel - Iterations (replay)\n"
+                "C - Compare neighbouring limits\n";
+            }
+            info +=
+            "O - Overlay (none/rooms/distance/flips)\n" +
+            std::string(source ? "" : "P - Play/pause\n") +
             "ESC - Exit";
 
             infoText.setString(info);
@@ -344,6 +4279,24 @@ private:
         }
     }
 
+    /**
+     * @brief Births, deaths and the neighbour histogram (as % of cells) of the last step
+     */
+
+    std::string describeStepStats() const {
+        const StepStats& stats = caveGen.getStepStats();
+        long long cells = stats.births + stats.deaths + stats.unchanged;
+        if (cells == 0) return std::string();
+
+        std::string text = "Births: " + std::to_string(stats.births) +
+                           "  Deaths: " + std::to_string(stats.deaths) + "\n" +
+                           "Neighbours 0-8 (%):\n";
+        for (int i = 0; i < 9; i++) {
+            text += (i ? " " : "") + std::to_string((stats.neighbors[i] * 100 + cells / 2) / cells);
+        }
+        return text + "\n";
+    }
+
     void drawInfoWithoutText(int x, int y) {
         sf::RectangleShape iterationBox(sf::Vector2f(200, 20));
         iterationBox.setPosition(x, y + 40);
@@ -352,12 +4305,512 @@ private:
     }
 };
 
+#endif // CAVE_LIBRARY
+
+/**
+ * @struct CaveParameters
+ * @brief Settings of one cave generation run
+ */
+
+struct CaveParameters {
+    int width, height;
+    double birthChance;
+    int birthLimit, deathLimit;
+    int steps;
+};
+
+/**
+ * @brief Worker threads that fit a memory budget
+ * @param perWorker Bytes each worker needs
+ * @param shared Bytes needed once, whatever the number of workers
+ * @param budget Bytes allowed (0 - unlimited)
+ * @param workers Wanted number of workers (0 - all hardware threads)
+ * @return Number of workers, 0 if not even one fits
+ */
+
+inline int workersForBudget(size_t perWorker, size_t shared, size_t budget, int workers) {
+    if (workers <= 0) workers = static_cast<int>(std::thread::hardware_concurrency());
+    if (workers <= 0) workers = 1;
+    if (budget == 0) return workers;
+    if (shared + perWorker > budget) return 0;
+    return static_cast<int>(std::min<size_t>(workers, (budget - shared) / std::max<size_t>(perWorker, 1)));
+}
+
+/**
+ * @struct SeedCriteria
+ * @brief Requirements a generated cave must meet in a seed search
+ */
+
+struct SeedCriteria {
+    double minOpenRatio;    ///< Smallest allowed fraction of open cells
+    double maxOpenRatio;    ///< Largest allowed fraction of open cells
+    bool singleRegion;      ///< All open cells must be connected
+    int minRooms;           ///< Fewest rooms (see detectRooms); 0 - no check
+};
+
+/**
+ * @struct SeedSearchResult
+ * @brief Seeds found by a seed search and how the candidates fared
+ */
+
+struct SeedSearchResult {
+    std::vector<unsigned> seeds;
+    long long evaluated;
+    long long rejectedEarly;        ///< Open ratio far off halfway through the steps
+    long long rejectedOpenRatio;
+    long long rejectedConnectivity;
+    long long rejectedRooms;
+    double seconds;
+    double seedsPerSecond;
+};
+
+/**
+ * @brief Search for seeds whose caves meet the criteria
+ * @param params Cave settings
+ * @param criteria Requirements
+ * @param wanted Number of seeds to find
+ * @param firstSeed First candidate seed
+ * @param maxCandidates Give up after this many candidates
+ * @param workers Worker threads (0 - all hardware threads)
+ * @param memoryBudget Bytes the search may use (0 - unlimited); fewer
+ *        workers run if all of them would not fit
+ * @return The lowest matching seeds, in ascending order, with throughput metrics
+ *
+ * Cheap checks run first: the open ratio is checked halfway through the
+ * steps with a wider tolerance, then at the end, then connectivity, and
+ * the room count last. Workers claim candidates in order and stop only
+ * past the wanted-th lowest match, so the result does not depend on timing.
+ */
+
+SeedSearchResult searchSeeds(const CaveParameters& params, const SeedCriteria& criteria, int wanted,
+                             unsigned firstSeed, long long maxCandidates, int workers = 0,
+                             size_t memoryBudget = 0) {
+    const double earlySlack = 0.1;
+    std::atomic<long long> next(0), limit(maxCandidates), evaluated(0);
+    std::atomic<long long> early(0), openRatio(0), connectivity(0), rooms(0);
+    std::vector<long long> accepted;  // lowest matching indices, at most wanted
+    std::mutex resultMutex;
+    SeedSearchResult result = SeedSearchResult();
+    auto start = std::chrono::steady_clock::now();
+
+    // Packed open grid, plus labels and distances of the room detection
+    size_t cells = static_cast<size_t>(params.width) * params.height;
+    size_t perWorker = CaveGenerator::estimateMemory(params.width, params.height, false) + cells / 8 +
+                       (criteria.minRooms > 0 ? cells * 3 * sizeof(int) : 0);
+    workers = workersForBudget(perWorker, 0, memoryBudget, workers);
+    if (workers == 0) {
+        std::cerr << "A " << params.width << "x" << params.height << " search needs " << perWorker
+                  << " bytes, more than the budget of " << memoryBudget << std::endl;
+        return result;
+    }
+
+    parallelFor(0, workers, [&](int, int) {
+        CaveGenerator generator(params.width, params.height, params.birthChance,
+                                params.birthLimit, params.deathLimit);
+        generator.setKeepHistory(false);
+        double cells = static_cast<double>(params.width) * params.height;
+
+        while (wanted > 0) {
+            long long index = next++;
+            if (index >= limit) break;
+            evaluated++;
+            unsigned seed = firstSeed + static_cast<unsigned>(index);
+
+            generator.initializeCave(seed);
+            int half = params.steps / 2;
+            for (int s = 0; s < half; s++) generator.simulateStep();
+            double ratio = 1.0 - generator.getAliveCount() / cells;
+            if (half > 0 && (ratio < criteria.minOpenRatio - earlySlack || ratio > criteria.maxOpenRatio + earlySlack)) {
+                early++;
+                continue;
+            }
+
+            for (int s = half; s < params.steps; s++) generator.simulateStep();
+            ratio = 1.0 - generator.getAliveCount() / cells;
+            if (ratio < criteria.minOpenRatio || ratio > criteria.maxOpenRatio) {
+                openRatio++;
+                continue;
+            }
+
+            PackedGrid open = PackedGrid::fromCave(generator.getCave(), false);
+            if (criteria.singleRegion) {
+                std::vector<CavePoint> source;
+                for (int y = 0; y < open.getHeight() && source.empty(); y++) {
+                    for (int i = 0; i < open.getWordsPerRow(); i++) {
+                        if (open.row(y)[i]) {
+                            source.push_back(CavePoint{i * 64 + __builtin_ctzll(open.row(y)[i]), y});
+                            break;
+                        }
+                    }
+                }
+                if (computeReachable(open, source).count() != open.count()) {
+                    connectivity++;
+                    continue;
+                }
+            }
+
+            if (criteria.minRooms > 0 && static_cast<int>(detectRooms(open).rooms.size()) < criteria.minRooms) {
+                rooms++;
+                continue;
+            }
+
+            // Candidates are claimed in order, so once the wanted-th lowest
+            // match is known, every lower index is already being evaluated
+            std::lock_guard<std::mutex> lock(resultMutex);
+            accepted.insert(std::lower_bound(accepted.begin(), accepted.end(), index), index);
+            if (static_cast<int>(accepted.size()) > wanted) accepted.pop_back();
+            if (static_cast<int>(accepted.size()) == wanted && accepted.back() + 1 < limit) {
+                limit = accepted.back() + 1;
+            }
+        }
+    }, workers);
+
+    for (long long index : accepted) result.seeds.push_back(firstSeed + static_cast<unsigned>(index));
+    result.evaluated = evaluated;
+    result.rejectedEarly = early;
+    result.rejectedOpenRatio = openRatio;
+    result.rejectedConnectivity = connectivity;
+    result.rejectedRooms = rooms;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.seedsPerSecond = result.seconds > 0.0 ? result.evaluated / result.seconds : 0.0;
+    return result;
+}
+
+/**
+ * @brief Generate a batch of caves from consecutive seeds and drop near-duplicates
+ * @param params Cave settings
+ * @param count Number of caves to generate
+ * @param firstSeed Seed of the first cave
+ * @param memoryBudget Bytes the batch may use (0 - unlimited)
+ * @return Exit status
+ *
+ * With a budget, fewer workers and smaller chunks are used to fit, and the
+ * batch stops with an error before the kept caves would exceed it.
+ */
+
+int runBatch(const CaveParameters& params, int count, unsigned firstSeed, size_t memoryBudget = 0) {
+    size_t gridBytes = PackedGrid(params.width, params.height).getMemoryBytes() + sizeof(PackedGrid);
+    int chunk = 1024;
+    if (memoryBudget > 0) {
+        chunk = static_cast<int>(std::max<size_t>(std::min<size_t>(chunk, memoryBudget / 4 / gridBytes), 1));
+    }
+    size_t perWorker = CaveGenerator::estimateMemory(params.width, params.height, false);
+    int workers = workersForBudget(perWorker, chunk * gridBytes, memoryBudget, 0);
+    if (workers == 0) {
+        std::cerr << "A " << params.width << "x" << params.height << " batch does not fit the budget of "
+                  << memoryBudget << " bytes" << std::endl;
+        return 1;
+    }
+
+    CaveDeduplicator dedup;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int base = 0; base < count; base += chunk) {
+        int n = std::min(chunk, count - base);
+        size_t used = dedup.getMemoryBytes() + n * gridBytes + workers * perWorker;
+        if (memoryBudget > 0 && used + n * (gridBytes + CaveDeduplicator::estimateIndexBytes()) > memoryBudget) {
+            std::cerr << "Memory budget reached after " << base << " caves (" << dedup.size()
+                      << " unique kept)" << std::endl;
+            return 1;
+        }
+        std::vector<PackedGrid> grids(n);
+        parallelFor(0, n, [&](int begin, int end) {
+            CaveGenerator generator(params.width, params.height, params.birthChance,
+                                    params.birthLimit, params.deathLimit);
+            generator.setKeepHistory(false);
+            for (int i = begin; i < end; i++) {
+                generator.initializeCave(firstSeed + base + i);
+                for (int s = 0; s < params.steps; s++) generator.simulateStep();
+                grids[i] = PackedGrid::fromCave(generator.getCave(), true);
+            }
+        }, workers);
+        for (int i = 0; i < n; i++) {
+            dedup.insert(grids[i]);
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Generated: " << count << ", unique: " << dedup.size()
+              << ", duplicates: " << count - static_cast<int>(dedup.size())
+              << " (" << seconds << " s)" << std::endl;
+    return 0;
+}
+
+/**
+ * @struct StreamJob
+ * @brief One generation request read in stream mode
+ */
+
+struct StreamJob {
+    uint64_t id;
+    CaveParameters params;
+    unsigned seed;
+};
+
+/**
+ * @brief Generate caves for a stream of jobs from stdin, writing frames to stdout
+ * @param workers Worker threads (0 - all hardware threads)
+ * @return Exit status
+ *
+ * Input is one job per line: "width height birthChance birthLimit deathLimit
+ * iterations seed"; empty lines and lines starting with '#' are skipped,
+ * malformed lines and caves over 2^30 cells are reported on stderr, as are
+ * jobs that run out of memory. Each finished job is written as
+ * soon as it completes (so frames may come out of order) as a frame of
+ * little-endian fields:
+ *
+ *     char[4]  "CAVF"
+ *     uint64   job id (0-based input line number among jobs)
+ *     uint32   seed
+ *     int32    width, height
+ *     uint32   words per row
+ *     uint64   payload size in bytes
+ *     uint64[] packed rows, PackedGrid layout, 1 - wall
+ *
+ * At most two jobs per worker wait in the queue, so a fast producer is
+ * held back instead of buffering the whole input.
+ */
+
+int runStream(int workers = 0) {
+    if (workers <= 0) workers = static_cast<int>(std::thread::hardware_concurrency());
+    if (workers <= 0) workers = 1;
+    const size_t capacity = static_cast<size_t>(workers) * 2;
+    const long long maxCells = 1LL << 30;
+
+    std::deque<StreamJob> queue;
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::mutex outputMutex;
+    bool finished = false;
+
+    auto writeFrame = [&](const StreamJob& job, const PackedGrid& grid) {
+        uint32_t seed = job.seed;
+        int32_t w = grid.getWidth();
+        int32_t h = grid.getHeight();
+        uint32_t words = static_cast<uint32_t>(grid.getWordsPerRow());
+        uint64_t payload = static_cast<uint64_t>(words) * h * sizeof(uint64_t);
+
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::fwrite("CAVF", 1, 4, stdout);
+        std::fwrite(&job.id, sizeof(job.id), 1, stdout);
+        std::fwrite(&seed, sizeof(seed), 1, stdout);
+        std::fwrite(&w, sizeof(w), 1, stdout);
+        std::fwrite(&h, sizeof(h), 1, stdout);
+        std::fwrite(&words, sizeof(words), 1, stdout);
+        std::fwrite(&payload, sizeof(payload), 1, stdout);
+        if (payload) std::fwrite(grid.row(0), 1, static_cast<size_t>(payload), stdout);
+        std::fflush(stdout);
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < workers; i++) {
+        pool.push_back(std::thread([&]() {
+            while (true) {
+                StreamJob job;
+                {
+                    std::unique_lock<std::mutex> lock(queueMutex);
+                    queueChanged.wait(lock, [&]() { return finished || !queue.empty(); });
+                    if (queue.empty()) return;
+                    job = queue.front();
+                    queue.pop_front();
+                }
+                queueChanged.notify_all();
+
+                try {
+                    CaveGenerator generator(job.params.width, job.params.height, job.params.birthChance,
+                                            job.params.birthLimit, job.params.deathLimit);
+                    generator.setKeepHistory(false);
+                    generator.initializeCave(job.seed);
+                    for (int s = 0; s < job.params.steps; s++) generator.simulateStep();
+                    writeFrame(job, PackedGrid::fromCave(generator.getCave(), true));
+                } catch (const std::bad_alloc&) {
+                    std::lock_guard<std::mutex> lock(outputMutex);
+                    std::cerr << "Skipping job " << job.id << ": out of memory" << std::endl;
+                }
+            }
+        }));
+    }
+
+    std::string line;
+    uint64_t nextId = 0;
+    long long lineNumber = 0;
+    while (std::getline(std::cin, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream fields(line);
+        StreamJob job;
+        if (!(fields >> job.params.width >> job.params.height >> job.params.birthChance
+              >> job.params.birthLimit >> job.params.deathLimit >> job.params.steps >> job.seed) ||
+            job.params.width <= 0 || job.params.height <= 0 || job.params.steps < 0) {
+            std::cerr << "Skipping malformed job on line " << lineNumber << std::endl;
+            continue;
+        }
+        if (static_cast<long long>(job.params.width) * job.params.height > maxCells) {
+            std::cerr << "Skipping oversized job on line " << lineNumber << std::endl;
+            continue;
+        }
+        job.id = nextId++;
+
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueChanged.wait(lock, [&]() { return queue.size() < capacity; });
+        queue.push_back(job);
+        lock.unlock();
+        queueChanged.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        finished = true;
+    }
+    queueChanged.notify_all();
+    for (auto& t : pool) {
+        t.join();
+    }
+    return 0;
+}
+
+#ifdef CAVE_LIBRARY
+
+/**
+ * @struct CaveHandle
+ * @brief Generator plus the buffers exposed through the C API
+ *
+ * The buffers are a mirror copy of the cave, allocated once and
+ * refreshed in place (one pass over the cells) after every call that
+ * changes it, so views handed out to callers (for example NumPy arrays)
+ * stay valid for the lifetime of the handle.
+ */
+
+struct CaveHandle {
+    CaveGenerator generator;
+    PackedGrid packed;
+    std::vector<uint8_t> bytes;
+
+    CaveHandle(int w, int h, double chance, int birth, int death)
+    : generator(w, h, chance, birth, death), packed(w, h), bytes(static_cast<size_t>(w) * h) {
+        sync();
+    }
+
+    /**
+     * @brief Copy the cave into both buffers in one pass over the cells
+     */
+
+    void sync() {
+        const auto& cave = generator.getCave();
+        int w = generator.getWidth();
+        int h = generator.getHeight();
+        int wordsPerRow = packed.getWordsPerRow();
+        packed.clear();
+        for (int x = 0; x < w; x++) {
+            const std::vector<bool>& column = cave[x];
+            uint64_t bit = uint64_t(1) << (x & 63);
+            uint64_t* word = packed.row(0) + (x >> 6);
+            uint8_t* byte = bytes.data() + x;
+            for (int y = 0; y < h; y++, word += wordsPerRow, byte += w) {
+                bool alive = column[y];
+                if (alive) *word |= bit;
+                *byte = alive ? 1 : 0;
+            }
+        }
+    }
+};
+
+/*
+ * C interface of libcavegen.so. Cells are 1 for walls (alive) and 0 for
+ * open space; both buffers are row-major.
+ */
+
+extern "C" {
+
+CaveHandle* cave_create(int width, int height, double birthChance, int birthLimit, int deathLimit) {
+    if (width <= 0 || height <= 0) return nullptr;
+    return new CaveHandle(width, height, birthChance, birthLimit, deathLimit);
+}
+
+void cave_destroy(CaveHandle* handle) {
+    delete handle;
+}
+
+void cave_init(CaveHandle* handle, unsigned seed) {
+    handle->generator.initializeCave(seed);
+    handle->sync();
+}
+
+void cave_step(CaveHandle* handle, int steps) {
+    for (int i = 0; i < steps; i++) {
+        handle->generator.simulateStep();
+    }
+    handle->sync();
+}
+
+void cave_set_rules(CaveHandle* handle, double birthChance, int birthLimit, int deathLimit) {
+    handle->generator.setBirthChance(birthChance);
+    handle->generator.setBirthLimit(birthLimit);
+    handle->generator.setDeathLimit(deathLimit);
+}
+
+void cave_morphology(CaveHandle* handle, int op, int shape, int radius) {
+    handle->generator.applyMorphology(static_cast<MorphOp>(op), static_cast<StructuringElement>(shape), radius);
+    handle->sync();
+}
+
+int cave_width(const CaveHandle* handle) { return handle->generator.getWidth(); }
+int cave_height(const CaveHandle* handle) { return handle->generator.getHeight(); }
+int cave_words_per_row(const CaveHandle* handle) { return handle->packed.getWordsPerRow(); }
+unsigned cave_seed(const CaveHandle* handle) { return handle->generator.getSeed(); }
+long long cave_generation(const CaveHandle* handle) { return handle->generator.getGeneration(); }
+long long cave_alive_count(const CaveHandle* handle) { return handle->packed.count(); }
+
+long long cave_memory_bytes(const CaveHandle* handle) {
+    return static_cast<long long>(handle->generator.getMemoryFootprint().total() +
+                                  handle->packed.getMemoryBytes() + handle->bytes.capacity());
+}
+
+uint8_t* cave_bytes(CaveHandle* handle) { return handle->bytes.data(); }
+uint64_t* cave_packed(CaveHandle* handle) { return handle->packed.row(0); }
+
+int cave_room_count(const CaveHandle* handle) {
+    return static_cast<int>(detectRooms(complementGrid(handle->packed)).rooms.size());
+}
+
+}
+
+#else
+
 /**
  * @brief Main function
+ * @param argc Argument count
+ * @param argv Arguments: none for the interactive viewer,
+ *        "--batch <count> [first seed] [budget MiB]" for headless batch generation,
+ *        "--seed-search <count> [first seed] [budget MiB]" to look for seeds meeting criteria,
+ *        "--publish <segment> [iterations]" to generate headless into shared memory,
+ *        "--view <segment>" to watch a generator started with --publish,
+ *        "--stream [workers]" to serve jobs from stdin as binary frames on stdout,
+ *        "--export <csv|tmx|json> <file> [seed]" to write a Tiled-compatible map,
+ *        "--checkpoint <file> [iterations] [every]" for a long run that resumes from
+ *        and periodically saves to a checkpoint file
  * @return Exit status
  */
 
-int main() {
+int main(int argc, char* argv[]) {
+    std::string mode = argc > 1 ? argv[1] : "";
+
+    if (mode == "--stream") {
+        return runStream(argc > 2 ? std::atoi(argv[2]) : 0);
+    }
+
+    if (mode == "--view") {
+        SharedCaveReader reader;
+        if (!reader.attach(argc > 2 ? argv[2] : "/cave")) return 1;
+
+        CaveGenerator mirror(reader.getWidth(), reader.getHeight(), 0.0, 0, 0);
+        std::cout << "Viewing " << reader.getName() << " (" << reader.getWidth() << " x "
+                  << reader.getHeight() << "), O - overlay, ESC - exit" << std::endl;
+        GraphicsManager graphics(mirror, &reader);
+        graphics.run();
+        return 0;
+    }
     int width, height;
     double birthChance;
     int birthLimit, deathLimit;
@@ -374,13 +4827,143 @@ int main() {
     std::cout << "Enter death limit: ";
     std::cin >> deathLimit;
 
+    if (mode == "--batch") {
+        CaveParameters params = {width, height, birthChance, birthLimit, deathLimit, 0};
+        std::cout << "Enter number of iterations: ";
+        std::cin >> params.steps;
+        int count = argc > 2 ? std::atoi(argv[2]) : 100;
+        unsigned firstSeed = argc > 3 ? static_cast<unsigned>(std::strtoul(argv[3], nullptr, 10)) : 1;
+        size_t budget = argc > 4 ? static_cast<size_t>(std::strtoull(argv[4], nullptr, 10)) << 20 : 0;
+        return runBatch(params, count, firstSeed, budget);
+    }
+
+    if (mode == "--seed-search") {
+        CaveParameters params = {width, height, birthChance, birthLimit, deathLimit, 0};
+        SeedCriteria criteria = {0.0, 1.0, false, 0};
+        std::cout << "Enter number of iterations: ";
+        std::cin >> params.steps;
+        std::cout << "Enter open ratio range (min max): ";
+        std::cin >> criteria.minOpenRatio >> criteria.maxOpenRatio;
+        std::cout << "Require single region (0/1): ";
+        std::cin >> criteria.singleRegion;
+        std::cout << "Enter minimum room count: ";
+        std::cin >> criteria.minRooms;
+
+        int count = argc > 2 ? std::atoi(argv[2]) : 1;
+        unsigned firstSeed = argc > 3 ? static_cast<unsigned>(std::strtoul(argv[3], nullptr, 10)) : 1;
+        size_t budget = argc > 4 ? static_cast<size_t>(std::strtoull(argv[4], nullptr, 10)) << 20 : 0;
+        SeedSearchResult result = searchSeeds(params, criteria, count, firstSeed, 100000000LL, 0, budget);
+
+        std::cout << std::endl << "Seeds:";
+        for (unsigned seed : result.seeds) std::cout << " " << seed;
+        std::cout << std::endl
+                  << "Evaluated: " << result.evaluated << " (" << result.seedsPerSecond << " seeds/s)" << std::endl
+                  << "Rejected early: " << result.rejectedEarly
+                  << ", open ratio: " << result.rejectedOpenRatio
+                  << ", connectivity: " << result.rejectedConnectivity
+                  << ", rooms: " << result.rejectedRooms << std::endl;
+        return result.seeds.empty() ? 1 : 0;
+    }
+
     CaveGenerator caveGen(width, height, birthChance, birthLimit, deathLimit);
+    StepConfig tuned = autoTuneStep(width, height);
+    caveGen.setStepConfig(tuned);
+    std::cout << std::endl << "Step kernel: " << (tuned.kernel == StepKernel::Columns ? "columns" : "cells")
+              << ", threads: " << tuned.workers << ", band: " << tuned.bandColumns << std::endl;
+
+    if (mode == "--export") {
+        if (argc < 4) {
+            std::cerr << "Usage: --export <csv|tmx|json> <file> [seed]" << std::endl;
+            return 1;
+        }
+        std::string format = argv[2];
+        std::string path = argv[3];
+        int steps = 0;
+        std::cout << "Enter number of iterations: ";
+        std::cin >> steps;
+        if (argc > 4) caveGen.initializeCave(static_cast<unsigned>(std::strtoul(argv[4], nullptr, 10)));
+        for (int i = 0; i < steps; i++) caveGen.simulateStep();
+
+        PackedGrid walls = PackedGrid::fromCave(caveGen.getCave(), true);
+        bool ok = false;
+        if (format == "csv") {
+            ok = exportCsv(walls, path);
+        } else if (format == "tmx") {
+            ok = exportTmx(walls, path);
+        } else if (format == "json") {
+            ok = exportTiledJson(walls, path);
+        } else {
+            std::cerr << "Unknown export format: " << format << std::endl;
+        }
+        if (ok) std::cout << std::endl << "Saved " << path << " (seed " << caveGen.getSeed() << ")" << std::endl;
+        return ok ? 0 : 1;
+    }
+
+    if (mode == "--checkpoint") {
+        if (argc < 3) {
+            std::cerr << "Usage: --checkpoint <file> [iterations] [every]" << std::endl;
+            return 1;
+        }
+        std::string path = argv[2];
+        long long steps = argc > 3 ? std::atoll(argv[3]) : 1000000;
+        long long every = argc > 4 ? std::max(1LL, std::atoll(argv[4])) : 1000;
+
+        struct stat existing;
+        if (stat(path.c_str(), &existing) == 0) {
+            PackedGrid walls;
+            CheckpointHeader header;
+            if (!loadCheckpoint(path, walls, header)) return 1;
+            if (header.width != width || header.height != height) {
+                std::cerr << "Checkpoint " << path << " is " << header.width << "x" << header.height
+                          << ", not " << width << "x" << height << std::endl;
+                return 1;
+            }
+            if (header.birthChance != birthChance || header.birthLimit != birthLimit ||
+                header.deathLimit != deathLimit) {
+                std::cerr << "Checkpoint " << path << " was made with rules " << header.birthChance << " "
+                          << header.birthLimit << " " << header.deathLimit << ", not " << birthChance << " "
+                          << birthLimit << " " << deathLimit << std::endl;
+                return 1;
+            }
+            caveGen.initializeCave(header.seed);
+            caveGen.loadCave(walls, header.generation);
+            std::cout << "Resuming from iteration " << header.generation << std::endl;
+        }
+
+        CheckpointWriter checkpoints(path);
+        while (caveGen.getGeneration() < steps) {
+            caveGen.simulateStep();
+            if (caveGen.getGeneration() % every == 0) {
+                checkpoints.submit(caveGen);
+            }
+        }
+        checkpoints.submit(caveGen);
+        checkpoints.flush();
+        std::cout << "Finished at iteration " << caveGen.getGeneration() << ", "
+                  << checkpoints.getWritten() << " checkpoints written" << std::endl;
+        return 0;
+    }
+
+    if (mode == "--publish") {
+        std::string segment = argc > 2 ? argv[2] : "/cave";
+        long long steps = argc > 3 ? std::atoll(argv[3]) : 1000000;
+        if (!caveGen.enableSharedMemory(segment)) return 1;
+        std::cout << "Publishing to " << segment << std::endl;
+        for (long long i = 0; i < steps; i++) {
+            caveGen.simulateStep();
+        }
+        return 0;
+    }
 
     std::cout << "Starting graphics interface..." << std::endl;
     std::cout << "Controls: SPACE - next iteration, R - new cave, ESC - exit" << std::endl;
+    std::cout << "Tuning: UP/DOWN - birth limit, LEFT/RIGHT - death limit, +/- - birth chance, "
+              << "[ ] or mouse wheel - iterations, C - compare limits, O - overlay, P - play" << std::endl;
 
     GraphicsManager graphics(caveGen);
     graphics.run();
 
     return 0;
 }
+
+#endif // CAVE_LIBRARY